@@ -0,0 +1,295 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+namespace
+{
+// Summary of a single run
+struct RunResult
+{
+    FlockMetrics metrics;
+    double meanSpeed = 0.0;
+    double spread = 0.0;
+    double msPerTick = 0.0;
+
+    // Fixed point run, if compared: its time per tick, the RMS and largest distance of its boids
+    // from the float ones at the end, and the first tick the RMS distance exceeded divergenceDistance
+    double fixedMsPerTick = 0.0;
+    double rmsDeviation = 0.0;
+    double maxDeviation = 0.0;
+    unsigned divergenceTick = 0;
+};
+
+// RMS distance beyond which a fixed point run counts as diverged from the float one
+constexpr double divergenceDistance = 1.0;
+
+// Setters for every sweepable FlockParams member
+const std::map<std::string, void (*)(FlockParams&, double)>& paramSetters()
+{
+    static const std::map<std::string, void (*)(FlockParams&, double)> setters = {
+        {"neighbourDistance", [](FlockParams& p, double v) { p.neighbourDistance = static_cast<float>(v); }},
+        {"avoidanceDistance", [](FlockParams& p, double v) { p.avoidanceDistance = static_cast<float>(v); }},
+        {"cohesionWeight", [](FlockParams& p, double v) { p.cohesionWeight = static_cast<float>(v); }},
+        {"alignmentWeight", [](FlockParams& p, double v) { p.alignmentWeight = static_cast<float>(v); }},
+        {"separationWeight", [](FlockParams& p, double v) { p.separationWeight = static_cast<float>(v); }},
+        {"targetWeight", [](FlockParams& p, double v) { p.targetWeight = static_cast<float>(v); }},
+        {"wideRuleStride", [](FlockParams& p, double v) { p.wideRuleStride = static_cast<unsigned>(v); }},
+        {"seed", [](FlockParams& p, double v) { p.seed = static_cast<std::uint32_t>(v); }},
+    };
+    return setters;
+}
+
+// RMS and largest distance between the boids of two flocks of the same size
+std::pair<double, double> deviation(const Flock& a, const Flock& b)
+{
+    double sum = 0.0, largest = 0.0;
+    for (unsigned i = 0; i != a.count(); ++i)
+    {
+        const auto d = glm::dvec2(a.positions()[i]) - glm::dvec2(b.positions()[i]);
+        const auto squared = glm::dot(d, d);
+        sum += squared;
+        largest = std::max(largest, squared);
+    }
+    return {a.count() != 0 ? std::sqrt(sum / a.count()) : 0.0, std::sqrt(largest)};
+}
+
+RunResult runOne(const SweepSpec& spec, FlockParams params)
+{
+    // Both flocks of a fixed point comparison must start from the same boids
+    if (spec.fixedPoint && params.seed == 0)
+    {
+        params.seed = std::random_device{}();
+    }
+
+    Flock flock(spec.boids, 0, params);
+    flock.setTarget(spec.target);
+    flock.setMetrics(MetricAll);
+
+    std::unique_ptr<Flock> fixed;
+    if (spec.fixedPoint)
+    {
+        fixed = std::make_unique<Flock>(spec.boids, 0, params);
+        fixed->setTarget(spec.target);
+        fixed->setFixedPoint(true);
+    }
+
+    RunResult result;
+    result.divergenceTick = spec.ticks;
+    std::chrono::duration<double, std::milli> elapsed(0.0), fixedElapsed(0.0);
+    for (unsigned t = 0; t != spec.ticks; ++t)
+    {
+        auto start = std::chrono::steady_clock::now();
+        flock.update(1.f / 120.f);
+        elapsed += std::chrono::steady_clock::now() - start;
+        if (!fixed)
+        {
+            continue;
+        }
+
+        start = std::chrono::steady_clock::now();
+        fixed->update(1.f / 120.f);
+        fixedElapsed += std::chrono::steady_clock::now() - start;
+        std::tie(result.rmsDeviation, result.maxDeviation) = deviation(flock, *fixed);
+        if (result.rmsDeviation > divergenceDistance && result.divergenceTick == spec.ticks)
+        {
+            result.divergenceTick = t + 1;
+        }
+    }
+
+    result.metrics = flock.metrics();
+    result.msPerTick = spec.ticks != 0 ? elapsed.count() / spec.ticks : 0.0;
+    result.fixedMsPerTick = spec.ticks != 0 ? fixedElapsed.count() / spec.ticks : 0.0;
+
+    // Speed and spread are only needed once per run, so they are not worth a metric flag
+    const auto count = flock.count();
+    if (count == 0)
+    {
+        return result;
+    }
+    glm::dvec2 centre(0.0);
+    for (unsigned i = 0; i != count; ++i)
+    {
+        result.meanSpeed += glm::length(flock.velocities()[i]);
+        centre += glm::dvec2(flock.positions()[i]);
+    }
+    result.meanSpeed /= count;
+    centre *= 1.0 / count;
+
+    // Spread is the RMS distance to the centre of the flock
+    for (unsigned i = 0; i != count; ++i)
+    {
+        const auto d = glm::dvec2(flock.positions()[i]) - centre;
+        result.spread += glm::dot(d, d);
+    }
+    result.spread = std::sqrt(result.spread / count);
+    return result;
+}
+} // namespace
+
+bool parseSweep(const std::string& path, SweepSpec& spec)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cout << "Failed to open sweep " << path << "!\n";
+        return false;
+    }
+
+    // Values of every setting, in the order they appear
+    std::vector<std::pair<std::string, std::vector<double>>> sweeps;
+
+    std::string line;
+    unsigned lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        ++lineNumber;
+        line = line.substr(0, line.find('#'));
+        const auto equals = line.find('=');
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+
+        std::istringstream keyStream(line.substr(0, equals));
+        std::string key;
+        keyStream >> key;
+        std::istringstream valueStream(equals == std::string::npos ? "" : line.substr(equals + 1));
+        std::vector<double> values;
+        for (double v; valueStream >> v;)
+        {
+            values.push_back(v);
+        }
+        if (equals == std::string::npos || values.empty() || !valueStream.eof())
+        {
+            std::cout << path << ":" << lineNumber << ": expected 'key = values...'\n";
+            return false;
+        }
+
+        if (key == "boids" || key == "ticks" || key == "targetX" || key == "targetY" || key == "fixedPoint")
+        {
+            if (values.size() != 1)
+            {
+                std::cout << path << ":" << lineNumber << ": " << key << " cannot be swept\n";
+                return false;
+            }
+            if (key == "boids")
+                spec.boids = static_cast<unsigned>(values[0]);
+            else if (key == "ticks")
+                spec.ticks = static_cast<unsigned>(values[0]);
+            else if (key == "targetX")
+                spec.target.x = static_cast<float>(values[0]);
+            else if (key == "fixedPoint")
+                spec.fixedPoint = values[0] != 0.0;
+            else
+                spec.target.y = static_cast<float>(values[0]);
+        }
+        else if (paramSetters().count(key))
+        {
+            sweeps.emplace_back(key, values);
+        }
+        else
+        {
+            std::cout << path << ":" << lineNumber << ": unknown setting " << key << '\n';
+            return false;
+        }
+    }
+
+    // Expand the cartesian product, the last setting varying fastest
+    std::vector<std::size_t> digits(sweeps.size(), 0);
+    for (;;)
+    {
+        FlockParams params;
+        for (std::size_t s = 0; s != sweeps.size(); ++s)
+        {
+            paramSetters().at(sweeps[s].first)(params, sweeps[s].second[digits[s]]);
+        }
+        spec.runs.push_back(params);
+
+        auto s = sweeps.size();
+        while (s != 0 && ++digits[s - 1] == sweeps[s - 1].second.size())
+        {
+            digits[--s] = 0;
+        }
+        if (s == 0)
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+int runBatch(const std::string& specPath, const std::string& outPath)
+{
+    SweepSpec spec;
+    if (!parseSweep(specPath, spec))
+    {
+        return 1;
+    }
+
+    std::ofstream out(outPath, std::ios::trunc);
+    if (!out)
+    {
+        std::cout << "Failed to open " << outPath << " for writing!\n";
+        return 1;
+    }
+
+    // One flock per worker, workers pull the next run until all are done
+    const auto runCount = static_cast<unsigned>(spec.runs.size());
+    const auto workerCount = std::min(std::max(std::thread::hardware_concurrency(), 1u), runCount);
+    std::cout << "Running " << runCount << " flocks of " << spec.boids << " boids for " << spec.ticks
+              << " ticks on " << workerCount << " threads\n";
+
+    std::vector<RunResult> results(runCount);
+    std::atomic<unsigned> next(0);
+    unsigned done = 0;
+    std::mutex progressMutex;
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w != workerCount; ++w)
+    {
+        workers.emplace_back([&] {
+            for (auto run = next++; run < runCount; run = next++)
+            {
+                results[run] = runOne(spec, spec.runs[run]);
+
+                std::lock_guard<std::mutex> lock(progressMutex);
+                std::cout << "Finished run " << ++done << "/" << runCount << '\n';
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    out << "run,neighbourDistance,avoidanceDistance,cohesionWeight,alignmentWeight,separationWeight,targetWeight,"
+           "wideRuleStride,seed,orderParameter,clusterCount,meanNearestNeighbour,collisions,meanSpeed,spread,msPerTick";
+    out << (spec.fixedPoint ? ",fixedMsPerTick,rmsDeviation,maxDeviation,divergenceTick\n" : "\n");
+    for (unsigned run = 0; run != runCount; ++run)
+    {
+        const auto& p = spec.runs[run];
+        const auto& r = results[run];
+        out << run << ',' << p.neighbourDistance << ',' << p.avoidanceDistance << ',' << p.cohesionWeight << ','
+            << p.alignmentWeight << ',' << p.separationWeight << ',' << p.targetWeight << ',' << p.wideRuleStride
+            << ',' << p.seed << ',' << r.metrics.orderParameter << ',' << r.metrics.clusterCount << ','
+            << r.metrics.meanNearestNeighbour << ',' << r.metrics.collisions << ',' << r.meanSpeed << ','
+            << r.spread << ',' << r.msPerTick;
+        if (spec.fixedPoint)
+        {
+            out << ',' << r.fixedMsPerTick << ',' << r.rmsDeviation << ',' << r.maxDeviation << ',' << r.divergenceTick;
+        }
+        out << '\n';
+    }
+    return out ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "flock.h"
+
+// A parameter sweep, read from a text file with one setting per line:
+//
+//   # Comments start with a hash
+//   boids = 2000
+//   ticks = 1200
+//   neighbourDistance = 40 60 80
+//   cohesionWeight = 0.005 0.01
+//
+// Settings that list several values are swept, and every combination becomes one run. The
+// settings are boids, ticks, targetX, targetY and fixedPoint (single values) plus every
+// FlockParams member. With fixedPoint = 1 every run is also simulated in fixed point from the
+// same initial boids, and its timing and distance from the float run are reported as well.
+struct SweepSpec
+{
+    // Boids per flock and ticks simulated per run
+    unsigned boids = 888;
+    unsigned ticks = 1200;
+
+    // Location the boids are attracted to
+    glm::vec2 target{400.f, 400.f};
+
+    // Compare every run against a fixed point simulation of it
+    bool fixedPoint = false;
+
+    // Parameters of every run
+    std::vector<FlockParams> runs;
+};
+
+// Read a sweep from path, printing any problem and returning false on failure
+bool parseSweep(const std::string& path, SweepSpec& spec);
+
+// Run every flock of the sweep in spec headless on all cores, writing one CSV line of summary
+// metrics per run to outPath. Returns the process exit code.
+int runBatch(const std::string& specPath, const std::string& outPath);
+
+#endif // BATCH_H
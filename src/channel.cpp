@@ -0,0 +1,183 @@
+#include "channel.h"
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+Channel::Channel(const int fd) : m_fd(fd)
+{
+    // Non-blocking, exchange() waits with poll instead
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+}
+
+Channel::Channel(Channel&& other) noexcept : m_fd(std::exchange(other.m_fd, -1))
+{
+}
+
+Channel& Channel::operator=(Channel&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        m_fd = std::exchange(other.m_fd, -1);
+    }
+    return *this;
+}
+
+Channel::~Channel()
+{
+    close();
+}
+
+void Channel::close()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool Channel::pair(Channel& a, Channel& b)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        return false;
+    }
+    a = Channel(fds[0]);
+    b = Channel(fds[1]);
+    return true;
+}
+
+bool Channel::send(const std::vector<unsigned char>& message)
+{
+    std::vector<Transfer> transfers{{this, &message, nullptr}};
+    return exchange(transfers);
+}
+
+bool Channel::receive(std::vector<unsigned char>& message)
+{
+    std::vector<Transfer> transfers{{this, nullptr, &message}};
+    return exchange(transfers);
+}
+
+bool exchange(std::vector<Transfer>& transfers)
+{
+    // Progress of every transfer, each message is an 8 byte length followed by the payload
+    struct Progress
+    {
+        std::uint64_t outSize;
+        std::size_t sent = 0;
+        unsigned char inHeader[8];
+        std::size_t received = 0;
+        std::uint64_t inSize = 0;
+    };
+    std::vector<Progress> progress(transfers.size());
+    for (std::size_t t = 0; t != transfers.size(); ++t)
+    {
+        progress[t].outSize = transfers[t].out ? transfers[t].out->size() : 0;
+    }
+
+    const auto sending = [&](const std::size_t t) {
+        return transfers[t].out && progress[t].sent < 8 + progress[t].outSize;
+    };
+    const auto receiving = [&](const std::size_t t) {
+        return transfers[t].in && (progress[t].received < 8 || progress[t].received < 8 + progress[t].inSize);
+    };
+
+    std::vector<pollfd> fds(transfers.size());
+    for (;;)
+    {
+        bool pending = false;
+        for (std::size_t t = 0; t != transfers.size(); ++t)
+        {
+            fds[t].fd = transfers[t].channel->fd();
+            fds[t].events = static_cast<short>((sending(t) ? POLLOUT : 0) | (receiving(t) ? POLLIN : 0));
+            fds[t].revents = 0;
+            pending = pending || fds[t].events != 0;
+        }
+        if (!pending)
+        {
+            return true;
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        for (std::size_t t = 0; t != transfers.size(); ++t)
+        {
+            auto& p = progress[t];
+            const int fd = fds[t].fd;
+            if ((fds[t].revents & (POLLERR | POLLNVAL)) != 0)
+            {
+                return false;
+            }
+
+            if ((fds[t].revents & POLLOUT) != 0 && sending(t))
+            {
+                const unsigned char* data;
+                std::size_t size;
+                if (p.sent < 8)
+                {
+                    data = reinterpret_cast<const unsigned char*>(&p.outSize) + p.sent;
+                    size = 8 - p.sent;
+                }
+                else
+                {
+                    data = transfers[t].out->data() + (p.sent - 8);
+                    size = p.outSize - (p.sent - 8);
+                }
+                const auto n = ::send(fd, data, size, MSG_NOSIGNAL);
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    return false;
+                }
+                p.sent += n > 0 ? static_cast<std::size_t>(n) : 0;
+            }
+
+            if ((fds[t].revents & (POLLIN | POLLHUP)) != 0 && receiving(t))
+            {
+                unsigned char* data;
+                std::size_t size;
+                if (p.received < 8)
+                {
+                    data = p.inHeader + p.received;
+                    size = 8 - p.received;
+                }
+                else
+                {
+                    data = transfers[t].in->data() + (p.received - 8);
+                    size = p.inSize - (p.received - 8);
+                }
+                const auto n = ::recv(fd, data, size, 0);
+                if (n == 0)
+                {
+                    return false; // Peer hung up mid message
+                }
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    return false;
+                }
+                p.received += n > 0 ? static_cast<std::size_t>(n) : 0;
+
+                // Size the payload once the length is known
+                if (p.received == 8)
+                {
+                    std::memcpy(&p.inSize, p.inHeader, sizeof(p.inSize));
+                    transfers[t].in->resize(p.inSize);
+                }
+            }
+        }
+    }
+}
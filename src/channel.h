@@ -0,0 +1,56 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <cstdint>
+#include <vector>
+
+// A connection to another process carrying length-prefixed messages. Built on a stream socket,
+// so the same code works over Unix domain sockets today and TCP later.
+class Channel
+{
+private:
+    int m_fd = -1;
+
+public:
+    Channel() = default;
+
+    // Takes ownership of a connected stream socket
+    explicit Channel(const int fd);
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+    Channel(Channel&& other) noexcept;
+    Channel& operator=(Channel&& other) noexcept;
+
+    ~Channel();
+
+    explicit operator bool() const { return m_fd >= 0; }
+    int fd() const { return m_fd; }
+
+    // Close the socket, leaving the channel unconnected
+    void close();
+
+    // Create a connected pair of channels
+    static bool pair(Channel& a, Channel& b);
+
+    bool send(const std::vector<unsigned char>& message);
+    bool receive(std::vector<unsigned char>& message);
+};
+
+// One direction or both of a message exchange over a channel
+struct Transfer
+{
+    Channel* channel;
+
+    // Message to send, or nullptr
+    const std::vector<unsigned char>* out;
+
+    // Where to store the received message, or nullptr
+    std::vector<unsigned char>* in;
+};
+
+// Perform all transfers at once. Peers that send to each other at the same time would deadlock
+// on full socket buffers with blocking calls, so sending and receiving are interleaved with poll.
+bool exchange(std::vector<Transfer>& transfers);
+
+#endif // CHANNEL_H
@@ -0,0 +1,346 @@
+#include "codec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+// Boids per independently coded block
+constexpr unsigned blockBoids = 16384;
+
+// Plane bytes sharing one bit width
+constexpr std::size_t groupSize = 128;
+
+// Fixed point scales. Positions keep 1/64 of a unit, velocities (at most 10) 1/4096
+constexpr float positionScale = 64.f;
+constexpr float velocityScale = 4096.f;
+
+// Run f(i) for i in [0, count) on scheduler, whose threads are started for the available cores
+// the first time there is more than one item, and kept for every later tick
+template <typename F>
+void parallelFor(Scheduler& scheduler, const unsigned count, F&& f)
+{
+    const auto cores = std::max(std::thread::hardware_concurrency(), 1u);
+    if (count > 1 && scheduler.workers() != cores)
+    {
+        scheduler.resize(cores);
+    }
+
+    std::vector<TaskRange> items(count);
+    for (unsigned i = 0; i != count; ++i)
+    {
+        items[i] = {i, i + 1};
+    }
+    scheduler.run(items, [&](const TaskRange& range, unsigned) {
+        for (auto i = range.first; i != range.last; ++i)
+        {
+            f(i);
+        }
+    });
+}
+
+std::uint32_t zigzag(const std::int32_t v)
+{
+    return (static_cast<std::uint32_t>(v) << 1) ^ static_cast<std::uint32_t>(v >> 31);
+}
+
+std::int32_t unzigzag(const std::uint32_t u)
+{
+    return static_cast<std::int32_t>((u >> 1) ^ (~(u & 1) + 1));
+}
+
+// Bit-pack bytes in groups of groupSize, each prefixed with its bit width
+void pack(const unsigned char* bytes, const std::size_t count, std::vector<unsigned char>& out)
+{
+    for (std::size_t first = 0; first < count; first += groupSize)
+    {
+        const auto last = std::min(first + groupSize, count);
+
+        unsigned char any = 0;
+        for (auto k = first; k != last; ++k)
+        {
+            any |= bytes[k];
+        }
+        unsigned width = 0;
+        while (width < 8 && (any >> width) != 0)
+        {
+            ++width;
+        }
+        out.push_back(static_cast<unsigned char>(width));
+
+        std::uint64_t bits = 0;
+        unsigned pending = 0;
+        for (auto k = first; k != last && width != 0; ++k)
+        {
+            bits |= static_cast<std::uint64_t>(bytes[k]) << pending;
+            pending += width;
+            while (pending >= 8)
+            {
+                out.push_back(static_cast<unsigned char>(bits));
+                bits >>= 8;
+                pending -= 8;
+            }
+        }
+        if (pending != 0)
+        {
+            out.push_back(static_cast<unsigned char>(bits));
+        }
+    }
+}
+
+// Reverse of pack(), returns false if in runs out before count bytes are produced
+bool unpack(const unsigned char*& in, const unsigned char* end, unsigned char* bytes, const std::size_t count)
+{
+    for (std::size_t first = 0; first < count; first += groupSize)
+    {
+        const auto last = std::min(first + groupSize, count);
+        if (in == end)
+        {
+            return false;
+        }
+        const unsigned width = *in++;
+        if (width > 8 || static_cast<std::size_t>(end - in) < ((last - first) * width + 7) / 8)
+        {
+            return false;
+        }
+
+        std::uint64_t bits = 0;
+        unsigned available = 0;
+        const unsigned mask = (1u << width) - 1;
+        for (auto k = first; k != last; ++k)
+        {
+            if (available < width)
+            {
+                bits |= static_cast<std::uint64_t>(*in++) << available;
+                available += 8;
+            }
+            bytes[k] = static_cast<unsigned char>(bits & mask);
+            bits >>= width;
+            available -= width;
+        }
+    }
+    return true;
+}
+
+// Encode one stream (every other value of current, starting at the first) against previous,
+// which is nullptr for keyframes
+void encodeStream(const std::int32_t* current, const std::int32_t* previous, const unsigned count,
+                  std::vector<unsigned char>& planes, std::vector<unsigned char>& out)
+{
+    planes.resize(4 * static_cast<std::size_t>(count));
+    for (unsigned k = 0; k != count; ++k)
+    {
+        const auto base = previous ? static_cast<std::uint32_t>(previous[2 * k]) : 0u;
+        const auto u = zigzag(static_cast<std::int32_t>(static_cast<std::uint32_t>(current[2 * k]) - base));
+        planes[k] = static_cast<unsigned char>(u);
+        planes[count + k] = static_cast<unsigned char>(u >> 8);
+        planes[2 * count + k] = static_cast<unsigned char>(u >> 16);
+        planes[3 * count + k] = static_cast<unsigned char>(u >> 24);
+    }
+    pack(planes.data(), planes.size(), out);
+}
+
+// Reverse of encodeStream()
+bool decodeStream(const unsigned char*& in, const unsigned char* end, const std::int32_t* previous,
+                  const unsigned count, std::vector<unsigned char>& planes, std::int32_t* current)
+{
+    planes.resize(4 * static_cast<std::size_t>(count));
+    if (!unpack(in, end, planes.data(), planes.size()))
+    {
+        return false;
+    }
+    for (unsigned k = 0; k != count; ++k)
+    {
+        const auto u = static_cast<std::uint32_t>(planes[k]) | static_cast<std::uint32_t>(planes[count + k]) << 8 |
+                       static_cast<std::uint32_t>(planes[2 * count + k]) << 16 |
+                       static_cast<std::uint32_t>(planes[3 * count + k]) << 24;
+        const auto base = previous ? static_cast<std::uint32_t>(previous[2 * k]) : 0u;
+        current[2 * k] = static_cast<std::int32_t>(base + static_cast<std::uint32_t>(unzigzag(u)));
+    }
+    return true;
+}
+
+std::int32_t quantize(const float v, const float scale)
+{
+    return static_cast<std::int32_t>(std::lrint(v * scale));
+}
+} // namespace
+
+TrajectoryEncoder::TrajectoryEncoder(const unsigned keyframeInterval)
+    : m_keyframeInterval(std::max(keyframeInterval, 1u)), m_sinceKeyframe(m_keyframeInterval)
+{
+}
+
+bool TrajectoryEncoder::encode(const glm::vec2* positions, const glm::vec2* velocities, const unsigned count,
+                               std::vector<unsigned char>& out)
+{
+    // A change in boid count also forces a keyframe, since deltas are per boid
+    const bool keyframe = m_sinceKeyframe >= m_keyframeInterval || m_previousPositions.size() != 2 * count;
+    m_sinceKeyframe = keyframe ? 1 : m_sinceKeyframe + 1;
+
+    m_positions.resize(2 * count);
+    m_velocities.resize(2 * count);
+
+    const auto blockCount = (count + blockBoids - 1) / blockBoids;
+    m_blocks.resize(blockCount);
+
+    parallelFor(m_scheduler, blockCount, [&](const unsigned b) {
+        const auto first = b * blockBoids;
+        const auto n = std::min(count - first, blockBoids);
+        for (auto i = first; i != first + n; ++i)
+        {
+            m_positions[2 * i] = quantize(positions[i].x, positionScale);
+            m_positions[2 * i + 1] = quantize(positions[i].y, positionScale);
+            m_velocities[2 * i] = quantize(velocities[i].x, velocityScale);
+            m_velocities[2 * i + 1] = quantize(velocities[i].y, velocityScale);
+        }
+
+        auto& block = m_blocks[b];
+        block.clear();
+        std::vector<unsigned char> planes;
+        for (unsigned c = 0; c != 2; ++c)
+        {
+            encodeStream(&m_positions[2 * first + c], keyframe ? nullptr : &m_previousPositions[2 * first + c], n,
+                         planes, block);
+        }
+        for (unsigned c = 0; c != 2; ++c)
+        {
+            encodeStream(&m_velocities[2 * first + c], keyframe ? nullptr : &m_previousVelocities[2 * first + c],
+                         n, planes, block);
+        }
+    });
+
+    CompressedChunkHeader header{};
+    header.keyframe = keyframe;
+    header.blockCount = blockCount;
+    header.positionScale = positionScale;
+    header.velocityScale = velocityScale;
+
+    std::size_t size = sizeof(header) + sizeof(std::uint64_t) * blockCount;
+    for (const auto& block : m_blocks)
+    {
+        size += block.size();
+    }
+    out.resize(size);
+
+    auto* cursor = out.data();
+    std::memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    for (const auto& block : m_blocks)
+    {
+        const std::uint64_t blockSize = block.size();
+        std::memcpy(cursor, &blockSize, sizeof(blockSize));
+        cursor += sizeof(blockSize);
+    }
+    for (const auto& block : m_blocks)
+    {
+        std::memcpy(cursor, block.data(), block.size());
+        cursor += block.size();
+    }
+
+    // The next delta is taken against what the decoder will have reconstructed, not the floats
+    std::swap(m_positions, m_previousPositions);
+    std::swap(m_velocities, m_previousVelocities);
+    return keyframe;
+}
+
+bool TrajectoryDecoder::decode(const unsigned char* payload, const std::size_t size, const unsigned count,
+                               glm::vec2* positions, glm::vec2* velocities)
+{
+    CompressedChunkHeader header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    std::memcpy(&header, payload, sizeof(header));
+
+    const auto blockCount = (count + blockBoids - 1) / blockBoids;
+    if (header.blockCount != blockCount || size < sizeof(header) + sizeof(std::uint64_t) * blockCount)
+    {
+        return false;
+    }
+    if (!header.keyframe && (!m_primed || m_previousPositions.size() != 2 * count))
+    {
+        return false;
+    }
+
+    // Locate every block before decoding them in parallel
+    std::vector<const unsigned char*> blocks(blockCount + 1);
+    const auto* end = payload + size;
+    const auto* cursor = payload + sizeof(header) + sizeof(std::uint64_t) * blockCount;
+    for (unsigned b = 0; b != blockCount; ++b)
+    {
+        std::uint64_t blockSize;
+        std::memcpy(&blockSize, payload + sizeof(header) + sizeof(std::uint64_t) * b, sizeof(blockSize));
+        if (blockSize > static_cast<std::uint64_t>(end - cursor))
+        {
+            return false;
+        }
+        blocks[b] = cursor;
+        cursor += blockSize;
+    }
+    blocks[blockCount] = cursor;
+
+    m_positions.resize(2 * count);
+    m_velocities.resize(2 * count);
+
+    std::atomic<bool> ok(true);
+    const bool keyframe = header.keyframe != 0;
+    parallelFor(m_scheduler, blockCount, [&](const unsigned b) {
+        const auto first = b * blockBoids;
+        const auto n = std::min(count - first, blockBoids);
+        const auto* in = blocks[b];
+        std::vector<unsigned char> planes;
+        for (unsigned c = 0; c != 2; ++c)
+        {
+            if (!decodeStream(in, blocks[b + 1], keyframe ? nullptr : &m_previousPositions[2 * first + c], n, planes,
+                              &m_positions[2 * first + c]))
+            {
+                ok = false;
+                return;
+            }
+        }
+        for (unsigned c = 0; c != 2; ++c)
+        {
+            if (!decodeStream(in, blocks[b + 1], keyframe ? nullptr : &m_previousVelocities[2 * first + c], n,
+                              planes, &m_velocities[2 * first + c]))
+            {
+                ok = false;
+                return;
+            }
+        }
+
+        const float positionStep = 1.f / header.positionScale;
+        const float velocityStep = 1.f / header.velocityScale;
+        for (auto i = first; i != first + n; ++i)
+        {
+            positions[i] = glm::vec2(m_positions[2 * i] * positionStep, m_positions[2 * i + 1] * positionStep);
+            velocities[i] = glm::vec2(m_velocities[2 * i] * velocityStep, m_velocities[2 * i + 1] * velocityStep);
+        }
+    });
+
+    if (!ok)
+    {
+        m_primed = false;
+        return false;
+    }
+
+    std::swap(m_positions, m_previousPositions);
+    std::swap(m_velocities, m_previousVelocities);
+    m_primed = true;
+    return true;
+}
+
+bool isKeyframe(const unsigned char* payload, const std::size_t size)
+{
+    CompressedChunkHeader header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    std::memcpy(&header, payload, sizeof(header));
+    return header.keyframe != 0;
+}
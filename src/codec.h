@@ -0,0 +1,92 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "scheduler.h"
+
+// Compressed encoding of trajectory ticks, stored in ChunkType::Compressed chunks.
+//
+// Positions and velocities are quantized to fixed point. Keyframes store the quantized values
+// directly, every other tick stores the difference to the previous encoded tick, which is small
+// since boid speed is clamped. Values are zigzag encoded, split into byte planes (byte shuffle)
+// so the mostly zero high bytes end up next to each other, and each run of 128 plane bytes is
+// bit-packed to the width of its largest byte.
+//
+// The boids are cut into independent blocks which are encoded and decoded in parallel, on a
+// pool of threads each encoder and decoder keeps for its lifetime.
+//
+// Payload layout:
+//
+//   CompressedChunkHeader
+//   std::uint64_t blockSizes[blockCount]
+//   Blocks, each holding the x/y position and x/y velocity streams of up to blockBoids boids
+
+struct CompressedChunkHeader
+{
+    // Non-zero if the chunk does not depend on the previous one
+    std::uint32_t keyframe;
+    std::uint32_t blockCount;
+
+    // Fixed point scales, a value v is stored as round(v * scale)
+    float positionScale;
+    float velocityScale;
+};
+
+class TrajectoryEncoder
+{
+private:
+    unsigned m_keyframeInterval;
+
+    // Ticks encoded since the last keyframe
+    unsigned m_sinceKeyframe = 0;
+
+    // Quantized values of the current and previous tick, x/y interleaved
+    std::vector<std::int32_t> m_positions, m_previousPositions;
+    std::vector<std::int32_t> m_velocities, m_previousVelocities;
+
+    // Output of every block, reused between ticks
+    std::vector<std::vector<unsigned char>> m_blocks;
+
+    // Encodes the blocks, its threads are started on the first tick with more than one block
+    Scheduler m_scheduler;
+
+public:
+    // Every keyframeInterval-th tick is a keyframe, so a reader never decodes more than that
+    // many ticks to reach any tick
+    explicit TrajectoryEncoder(const unsigned keyframeInterval = 120);
+
+    // Encode one tick and replace out with the payload. Returns true if it was a keyframe.
+    bool encode(const glm::vec2* positions, const glm::vec2* velocities, const unsigned count,
+                std::vector<unsigned char>& out);
+};
+
+class TrajectoryDecoder
+{
+private:
+    // Quantized values of the current and previous decoded tick, x/y interleaved
+    std::vector<std::int32_t> m_positions, m_previousPositions;
+    std::vector<std::int32_t> m_velocities, m_previousVelocities;
+
+    // Whether m_previous* hold a tick that a delta can be applied to
+    bool m_primed = false;
+
+    // Decodes the blocks, its threads are started on the first tick with more than one block
+    Scheduler m_scheduler;
+
+public:
+    // Forget the previous tick, the next decoded chunk must be a keyframe
+    void reset() { m_primed = false; }
+
+    // Decode one payload of count boids. Fails on corrupt data or a delta without a prior tick.
+    bool decode(const unsigned char* payload, const std::size_t size, const unsigned count, glm::vec2* positions,
+                glm::vec2* velocities);
+};
+
+// True if the payload is a keyframe
+bool isKeyframe(const unsigned char* payload, const std::size_t size);
+
+#endif // CODEC_H
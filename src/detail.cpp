@@ -48,7 +48,7 @@ void makeShader()
 
             void main()
             {
-            gl_Position = projectionMatrix * ((aInstance_Rotation * aPosition) + aInstance_Position);
+            gl_Position = projectionMatrix * ((aInstance_Rotation * aPosition) + vec4(aInstance_Position.xy, 0.f, 0.f));
             vs_color = smoothstep(color_min, color_max, vec4(length(aInstance_Velocity) / 10.f));
             })";
     int vertLen = strlen(vertSrc);
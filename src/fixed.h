@@ -0,0 +1,190 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <cmath>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+// Fixed point versions of the steering rules in rules.h, used by the fixed point mode of Flock.
+// Positions and velocities are 16.16 numbers in 32-bit integers (so the world spans +-32768
+// units), and a tick only uses integer arithmetic. The results are therefore the same bits on
+// every machine and compiler, and since integer sums do not depend on the order they are added
+// in, on any number of threads too.
+
+// Two 16.16 components
+using FixedVec = glm::ivec2;
+
+constexpr int fixedFractionBits = 16;
+constexpr std::int32_t fixedOne = 1 << fixedFractionBits;
+
+inline std::int32_t toFixed(const float v)
+{
+    return static_cast<std::int32_t>(std::lround(v * fixedOne));
+}
+
+inline FixedVec toFixed(const glm::vec2& v)
+{
+    return FixedVec(toFixed(v.x), toFixed(v.y));
+}
+
+inline float fromFixed(const std::int32_t v)
+{
+    return static_cast<float>(v) * (1.f / fixedOne);
+}
+
+inline glm::vec2 fromFixed(const FixedVec& v)
+{
+    return glm::vec2(fromFixed(v.x), fromFixed(v.y));
+}
+
+// a times the 16.16 number b, rounded down
+inline std::int32_t fixedMul(const std::int64_t a, const std::int32_t b)
+{
+    return static_cast<std::int32_t>((a * b) >> fixedFractionBits);
+}
+
+// Squared length, with 32 fractional bits
+inline std::int64_t lengthSquared(const FixedVec& v)
+{
+    return static_cast<std::int64_t>(v.x) * v.x + static_cast<std::int64_t>(v.y) * v.y;
+}
+
+// Square root rounded down, one bit at a time
+inline std::uint64_t integerSqrt(std::uint64_t v)
+{
+    std::uint64_t root = 0;
+    std::uint64_t bit = std::uint64_t(1) << 62;
+    while (bit > v)
+    {
+        bit >>= 2;
+    }
+    while (bit != 0)
+    {
+        if (v >= root + bit)
+        {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+// v scaled down until both components fit into 15 bits, keeping its direction to about 1e-4
+inline FixedVec significantBits(FixedVec v)
+{
+    constexpr std::int32_t limit = 1 << 14;
+    while (v.x >= limit || v.x < -limit || v.y >= limit || v.y < -limit)
+    {
+        v.x >>= 1;
+        v.y >>= 1;
+    }
+    return v;
+}
+
+// Same test as inFieldOfView(), without the arccosine: the angle is below 45 degrees when the dot
+// product is positive and dot^2 > cos^2(45) |v|^2 |diff|^2. Only the directions matter, so both
+// vectors are scaled down first to keep the products within 64 bits.
+inline bool inFieldOfView(const FixedVec& v, const FixedVec& diff)
+{
+    const auto a = significantBits(v);
+    const auto b = significantBits(diff);
+    const std::int64_t ax = a.x, ay = a.y, bx = b.x, by = b.y;
+    const auto dot = ax * bx + ay * by;
+    return dot > 0 && 2 * dot * dot > (ax * ax + ay * ay) * (bx * bx + by * by);
+}
+
+// Cohesion and alignment state of one boid. Both rules share the same range, so one count does.
+struct FixedWideAccumulator
+{
+    std::int64_t positionX = 0, positionY = 0;
+    std::int64_t velocityX = 0, velocityY = 0;
+    std::int64_t count = 0;
+};
+
+// Cohesion, alignment, separation and target seeking as in rules.h, plus the speed limit and
+// integration step, with every range and weight converted to 16.16
+struct FixedRules
+{
+    std::int64_t neighbourRangeSquared;
+    std::int64_t avoidanceRangeSquared;
+    std::int32_t cohesionWeight;
+    std::int32_t alignmentWeight;
+    std::int32_t separationWeight;
+    std::int32_t targetWeight;
+    std::int32_t maxSpeed;
+    FixedVec target;
+
+    // Gather the wide neighbourhood of boid i into acc. Candidates come from a grid built over
+    // keys, the float copies of positions; every test on them is done in fixed point.
+    template <typename Grid>
+    void gatherWide(FixedWideAccumulator& acc, const unsigned i, const Grid& grid, const glm::vec2* keys,
+                    const FixedVec* positions, const FixedVec* velocities) const
+    {
+        grid.forEachNear(keys[i], [&](const unsigned j) {
+            const auto diff = positions[j] - positions[i];
+            if (j != i && lengthSquared(diff) < neighbourRangeSquared && inFieldOfView(velocities[i], diff))
+            {
+                acc.positionX += positions[j].x;
+                acc.positionY += positions[j].y;
+                acc.velocityX += velocities[j].x;
+                acc.velocityY += velocities[j].y;
+                ++acc.count;
+            }
+        });
+    }
+
+    // Sum of the offsets to the narrow neighbours of boid i, see gatherWide()
+    template <typename Grid>
+    FixedVec gatherNarrow(const unsigned i, const Grid& grid, const glm::vec2* keys, const FixedVec* positions,
+                          const FixedVec* velocities) const
+    {
+        FixedVec sum(0);
+        grid.forEachNear(keys[i], [&](const unsigned j) {
+            const auto diff = positions[j] - positions[i];
+            if (j != i && lengthSquared(diff) < avoidanceRangeSquared && inFieldOfView(velocities[i], diff))
+            {
+                sum += diff;
+            }
+        });
+        return sum;
+    }
+
+    // Steering of a boid from its gathered neighbourhoods
+    FixedVec finalize(const FixedWideAccumulator& wide, const FixedVec& narrow, const FixedVec& position,
+                      const FixedVec& velocity) const
+    {
+        FixedVec steering(fixedMul(narrow.x, separationWeight), fixedMul(narrow.y, separationWeight));
+        steering += FixedVec(fixedMul(target.x - position.x, targetWeight), fixedMul(target.y - position.y, targetWeight));
+        if (wide.count != 0)
+        {
+            steering += FixedVec(fixedMul(wide.positionX / wide.count - position.x, cohesionWeight),
+                                 fixedMul(wide.positionY / wide.count - position.y, cohesionWeight));
+            steering += FixedVec(fixedMul(wide.velocityX / wide.count - velocity.x, alignmentWeight),
+                                 fixedMul(wide.velocityY / wide.count - velocity.y, alignmentWeight));
+        }
+        return steering;
+    }
+
+    // Apply steering, limit the speed and move
+    void integrate(FixedVec& position, FixedVec& velocity, const FixedVec& steering) const
+    {
+        velocity += steering;
+        const auto speedSquared = lengthSquared(velocity);
+        const std::int64_t limit = maxSpeed;
+        if (speedSquared > limit * limit)
+        {
+            const auto speed = static_cast<std::int64_t>(integerSqrt(static_cast<std::uint64_t>(speedSquared)));
+            velocity = FixedVec(static_cast<std::int32_t>(velocity.x * limit / speed),
+                                static_cast<std::int32_t>(velocity.y * limit / speed));
+        }
+        position += velocity;
+    }
+};
+
+#endif // FIXED_H
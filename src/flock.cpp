@@ -3,33 +3,46 @@
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
 #include <random>
+#include <thread>
 
 #include "gl_core4_5.hpp"
-#include "GLFW/glfw3.h"
 #include "glm/gtc/matrix_transform.hpp"
 
-extern GLFWwindow* g_window;
-
-Flock::Flock(const std::size_t count)
-    : m_positions(count), m_velocities(count), m_rotations(count), m_count(count)
+Flock::Flock(const std::size_t count, const std::size_t capacity, const FlockParams& params)
+    : m_params(params),
+      m_wideRules(Cohesion{params.neighbourDistance, params.cohesionWeight},
+                  Alignment{params.neighbourDistance, params.alignmentWeight}),
+      m_narrowRules(Separation{params.avoidanceDistance, params.separationWeight}),
+      m_selfRules(SeekTarget{glm::vec2(0.f), params.targetWeight}), m_wideGrid(m_wideRules.radius()),
+      m_narrowGrid(narrowCellSize()), m_count(0), m_capacity(0),
+      m_generator(params.seed != 0 ? params.seed : std::random_device{}())
 {
-    std::random_device seed;
-    std::mt19937 generator(seed());
+    m_scratch.push_back(std::make_unique<WorkerScratch>());
+    allocateStorage(static_cast<unsigned>(std::max(count, capacity)));
+    m_positions.resize(count);
+    m_velocities.resize(count);
+    m_rotations.resize(count);
+    m_wideCache.resize(count);
+    m_steering.resize(count);
+    m_nearestWide.resize(count, std::numeric_limits<float>::infinity());
+    m_count = static_cast<unsigned>(count);
+
     std::uniform_real_distribution<float> rng(0.f, 1.f);
 
     // Initialize Positions
     for (auto& p : m_positions)
     {
-        p.x = rng(generator) * 800.f;
-        p.y = rng(generator) * 800.f;
+        p.x = rng(m_generator) * 800.f;
+        p.y = rng(m_generator) * 800.f;
     }
 
     // Initialize Velocities
     for (auto& v : m_velocities)
     {
-        v.x = rng(generator) * 0.4f;
-        v.y = rng(generator) * 0.4f;
+        v.x = rng(m_generator) * 0.4f;
+        v.y = rng(m_generator) * 0.4f;
     }
 
     for (auto& r : m_rotations)
@@ -40,162 +53,1159 @@ Flock::Flock(const std::size_t count)
 
 Flock::~Flock()
 {
+    // Headless flocks never created any GL objects
+    if (m_vao == 0)
+    {
+        return;
+    }
+
     gl::DeleteVertexArrays(1, &m_vao);
+    gl::DeleteVertexArrays(1, &m_pointVao);
+    if (m_culledVao != 0)
+    {
+        gl::DeleteVertexArrays(1, &m_culledVao);
+    }
     gl::DeleteBuffers(1, &m_pvbo);
     gl::DeleteBuffers(1, &m_tvbo);
     gl::DeleteBuffers(1, &m_vvbo);
     gl::DeleteBuffers(1, &m_rvbo);
 }
 
-void Flock::createDrawData()
+void Flock::createInstanceBuffers(const unsigned capacity)
 {
+    // Buffer storage is immutable, so growing means replacing the buffers
+    if (m_bufferCapacity != 0)
+    {
+        gl::DeleteBuffers(1, &m_pvbo);
+        gl::DeleteBuffers(1, &m_rvbo);
+        gl::DeleteBuffers(1, &m_vvbo);
+    }
+    m_bufferCapacity = capacity;
+
     // Per Instance Position Buffer
     gl::CreateBuffers(1, &m_pvbo);
-    gl::NamedBufferStorage(m_pvbo, sizeof(glm::vec2) * m_count, m_positions.data(),
-                           gl::DYNAMIC_STORAGE_BIT);
+    gl::NamedBufferStorage(m_pvbo, sizeof(glm::vec2) * capacity, nullptr, gl::DYNAMIC_STORAGE_BIT);
+    gl::NamedBufferSubData(m_pvbo, 0, sizeof(glm::vec2) * m_count, m_positions.data());
 
     // Per Instance Rotation Buffer
     gl::CreateBuffers(1, &m_rvbo);
-    gl::NamedBufferStorage(m_rvbo, sizeof(glm::mat4) * m_count, m_rotations.data(),
-                           gl::DYNAMIC_STORAGE_BIT);
+    gl::NamedBufferStorage(m_rvbo, sizeof(glm::mat4) * capacity, nullptr, gl::DYNAMIC_STORAGE_BIT);
+    gl::NamedBufferSubData(m_rvbo, 0, sizeof(glm::mat4) * m_count, m_rotations.data());
 
     // Per Instance Velocity Buffer
     gl::CreateBuffers(1, &m_vvbo);
-    gl::NamedBufferStorage(m_vvbo, sizeof(glm::vec2) * m_count, m_velocities.data(),
-                           gl::DYNAMIC_STORAGE_BIT);
+    gl::NamedBufferStorage(m_vvbo, sizeof(glm::vec2) * capacity, nullptr, gl::DYNAMIC_STORAGE_BIT);
+    gl::NamedBufferSubData(m_vvbo, 0, sizeof(glm::vec2) * m_count, m_velocities.data());
+    m_drawCount = m_count;
+
+    // Binding 0 - Per Instance Position, Binding 2 - Rotations, Binding 3 - Velocities
+    gl::VertexArrayVertexBuffer(m_vao, 0, m_pvbo, 0, sizeof(glm::vec2));
+    gl::VertexArrayVertexBuffer(m_vao, 2, m_rvbo, 0, sizeof(glm::mat4));
+    gl::VertexArrayVertexBuffer(m_vao, 3, m_vvbo, 0, sizeof(glm::vec2));
+}
+
+void Flock::reserve(const unsigned capacity)
+{
+    if (capacity > m_capacity)
+    {
+        allocateStorage(capacity);
+    }
+}
 
+std::size_t Flock::storageBytes(const unsigned capacity, const unsigned ghosts, const unsigned workers)
+{
+    const std::size_t n = capacity;
+    const std::size_t perBoid = 5 * sizeof(glm::vec2) + 2 * sizeof(glm::mat4) + sizeof(WideRules::Accumulators) +
+                                sizeof(float) + 3 * sizeof(FixedVec) + sizeof(FixedWideAccumulator);
+
+    // Ghosts only go into the float and fixed positions and velocities
+    const std::size_t perGhost = 2 * sizeof(glm::vec2) + 2 * sizeof(FixedVec);
+
+    // Each grid holds boids and ghosts, with up to two buckets per entry, a start offset for
+    // each and a histogram of all of them per worker
+    const std::size_t entries = n + ghosts;
+    const std::size_t buckets = 2 * entries + 1;
+    const std::size_t perGrid =
+        entries * (2 * sizeof(unsigned) + sizeof(glm::ivec2)) + buckets * sizeof(unsigned) * (1 + workers);
+
+    // Plus alignment padding of every array
+    return n * perBoid + ghosts * perGhost + 2 * perGrid + 23 * Arena::alignment;
+}
+
+namespace
+{
+// Copy array into arena with room for capacity elements, each task copying its own range
+template <typename T>
+void moveArray(BoidArray<T>& array, Arena& arena, const unsigned capacity, Scheduler& scheduler,
+               const std::vector<TaskRange>& tasks)
+{
+    BoidArray<T> moved{ArenaAllocator<T>(&arena)};
+    moved.reserve(capacity);
+    moved.resize(array.size());
+    scheduler.run(tasks, [&](const TaskRange& range, unsigned) {
+        const auto last = std::min<std::size_t>(range.last, array.size());
+        if (range.first < last)
+        {
+            std::copy(array.begin() + range.first, array.begin() + last, moved.begin() + range.first);
+        }
+    });
+    array.swap(moved);
+}
+} // namespace
+
+void Flock::allocateStorage(const unsigned capacity)
+{
+    // The old arena must outlive the arrays moved out of it, which die inside moveArray()
+    const auto old = std::move(m_arena);
+    m_arena = std::make_unique<Arena>(storageBytes(capacity, m_ghostCapacity, m_scheduler.workers()));
+    m_capacity = capacity;
+
+    // Same chunks, and so the same workers, as the integration pass. The capacity beyond
+    // m_count is left to whoever spawns into it.
+    std::vector<TaskRange> tasks;
+    for (unsigned first = 0; first < m_count; first += integrateChunk)
+    {
+        tasks.push_back({first, std::min(m_count, first + integrateChunk)});
+    }
+    const auto withGhosts = capacity + m_ghostCapacity;
+    moveArray(m_positions, *m_arena, withGhosts, m_scheduler, tasks);
+    moveArray(m_velocities, *m_arena, withGhosts, m_scheduler, tasks);
+    moveArray(m_rotations, *m_arena, capacity, m_scheduler, tasks);
+    moveArray(m_wideCache, *m_arena, capacity, m_scheduler, tasks);
+    moveArray(m_steering, *m_arena, capacity, m_scheduler, tasks);
+    moveArray(m_nearestWide, *m_arena, capacity, m_scheduler, tasks);
+    moveArray(m_fixedPositions, *m_arena, withGhosts, m_scheduler, tasks);
+    moveArray(m_fixedVelocities, *m_arena, withGhosts, m_scheduler, tasks);
+    moveArray(m_fixedWideCache, *m_arena, capacity, m_scheduler, tasks);
+    moveArray(m_fixedSteering, *m_arena, capacity, m_scheduler, tasks);
+    moveArray(m_visiblePositions, *m_arena, capacity, m_scheduler, tasks);
+    moveArray(m_visibleVelocities, *m_arena, capacity, m_scheduler, tasks);
+    moveArray(m_visibleRotations, *m_arena, capacity, m_scheduler, tasks);
+
+    // Grids are rebuilt from scratch every tick, over the boids and ghosts
+    m_wideGrid = Grid(m_wideRules.radius(), m_arena.get());
+    m_narrowGrid = Grid(narrowCellSize(), m_arena.get());
+    m_wideGrid.reserve(withGhosts, m_scheduler.workers());
+    m_narrowGrid.reserve(withGhosts, m_scheduler.workers());
+}
+
+void Flock::createDrawData()
+{
     // Triangle Buffer
     gl::CreateBuffers(1, &m_tvbo);
     float data[6] = {-4.f, -4.f, -4.f, 4.f, 6.f, 0.f};
     gl::NamedBufferStorage(m_tvbo, sizeof(data), data, 0);
 
     // Vertex Array
-    gl::CreateVertexArrays(1, &m_vao);
+    createVertexArray(m_vao);
+
+    // Point Vertex Array, one vertex per boid with its position and velocity. The triangle and
+    // rotation attributes are left disabled, so the shader sees (0, 0, 0, 1) for each and the
+    // point lands on the boid's position.
+    gl::CreateVertexArrays(1, &m_pointVao);
+    gl::VertexArrayAttribBinding(m_pointVao, 0, 0);
+    gl::VertexArrayAttribFormat(m_pointVao, 0, 2, gl::FLOAT, gl::FALSE_, 0);
+    gl::EnableVertexArrayAttrib(m_pointVao, 0);
+    gl::VertexArrayAttribBinding(m_pointVao, 6, 3);
+    gl::VertexArrayAttribFormat(m_pointVao, 6, 2, gl::FLOAT, gl::FALSE_, 0);
+    gl::EnableVertexArrayAttrib(m_pointVao, 6);
+
+    // Per instance buffers are sized to the capacity of the flock, not its current count
+    createInstanceBuffers(std::max(m_capacity, 1u));
+}
+
+void Flock::createVertexArray(unsigned& vao)
+{
+    gl::CreateVertexArrays(1, &vao);
 
     // Attrib 0, Binding 0 - Per Instance Position
-    gl::VertexArrayVertexBuffer(m_vao, 0, m_pvbo, 0, sizeof(glm::vec2));
-    gl::VertexArrayAttribBinding(m_vao, 0, 0);
-    gl::VertexArrayAttribFormat(m_vao, 0, 2, gl::FLOAT, gl::FALSE_, 0);
-    gl::VertexArrayBindingDivisor(m_vao, 0, 1);
-    gl::EnableVertexArrayAttrib(m_vao, 0);
+    gl::VertexArrayAttribBinding(vao, 0, 0);
+    gl::VertexArrayAttribFormat(vao, 0, 2, gl::FLOAT, gl::FALSE_, 0);
+    gl::VertexArrayBindingDivisor(vao, 0, 1);
+    gl::EnableVertexArrayAttrib(vao, 0);
 
     // Attrib 1, Binding 1 - The Triangle
-    gl::VertexArrayVertexBuffer(m_vao, 1, m_tvbo, 0, sizeof(float) * 2);
-    gl::VertexArrayAttribFormat(m_vao, 1, 2, gl::FLOAT, gl::FALSE_, 0);
-    gl::VertexArrayAttribBinding(m_vao, 1, 1);
-    gl::EnableVertexArrayAttrib(m_vao, 1);
+    gl::VertexArrayVertexBuffer(vao, 1, m_tvbo, 0, sizeof(float) * 2);
+    gl::VertexArrayAttribFormat(vao, 1, 2, gl::FLOAT, gl::FALSE_, 0);
+    gl::VertexArrayAttribBinding(vao, 1, 1);
+    gl::EnableVertexArrayAttrib(vao, 1);
 
     // Attrib 2-5, Binding 2 - Rotations
-    gl::VertexArrayVertexBuffer(m_vao, 2, m_rvbo, 0, sizeof(glm::mat4));
-    gl::VertexArrayAttribFormat(m_vao, 2, 4, gl::FLOAT, gl::FALSE_, 0);
-    gl::VertexArrayAttribFormat(m_vao, 3, 4, gl::FLOAT, gl::FALSE_, 16);
-    gl::VertexArrayAttribFormat(m_vao, 4, 4, gl::FLOAT, gl::FALSE_, 32);
-    gl::VertexArrayAttribFormat(m_vao, 5, 4, gl::FLOAT, gl::FALSE_, 48);
-    gl::VertexArrayAttribBinding(m_vao, 2, 2);
-    gl::VertexArrayAttribBinding(m_vao, 3, 2);
-    gl::VertexArrayAttribBinding(m_vao, 4, 2);
-    gl::VertexArrayAttribBinding(m_vao, 5, 2);
-    gl::VertexArrayBindingDivisor(m_vao, 2, 1);
-    gl::VertexArrayBindingDivisor(m_vao, 3, 1);
-    gl::VertexArrayBindingDivisor(m_vao, 4, 1);
-    gl::VertexArrayBindingDivisor(m_vao, 5, 1);
-    gl::EnableVertexArrayAttrib(m_vao, 2);
-    gl::EnableVertexArrayAttrib(m_vao, 3);
-    gl::EnableVertexArrayAttrib(m_vao, 4);
-    gl::EnableVertexArrayAttrib(m_vao, 5);
+    gl::VertexArrayAttribFormat(vao, 2, 4, gl::FLOAT, gl::FALSE_, 0);
+    gl::VertexArrayAttribFormat(vao, 3, 4, gl::FLOAT, gl::FALSE_, 16);
+    gl::VertexArrayAttribFormat(vao, 4, 4, gl::FLOAT, gl::FALSE_, 32);
+    gl::VertexArrayAttribFormat(vao, 5, 4, gl::FLOAT, gl::FALSE_, 48);
+    gl::VertexArrayAttribBinding(vao, 2, 2);
+    gl::VertexArrayAttribBinding(vao, 3, 2);
+    gl::VertexArrayAttribBinding(vao, 4, 2);
+    gl::VertexArrayAttribBinding(vao, 5, 2);
+    gl::VertexArrayBindingDivisor(vao, 2, 1);
+    gl::VertexArrayBindingDivisor(vao, 3, 1);
+    gl::VertexArrayBindingDivisor(vao, 4, 1);
+    gl::VertexArrayBindingDivisor(vao, 5, 1);
+    gl::EnableVertexArrayAttrib(vao, 2);
+    gl::EnableVertexArrayAttrib(vao, 3);
+    gl::EnableVertexArrayAttrib(vao, 4);
+    gl::EnableVertexArrayAttrib(vao, 5);
 
     // Attrib 6, Binding 3 - Velocities
-    gl::VertexArrayVertexBuffer(m_vao, 3, m_vvbo, 0, sizeof(glm::vec2));
-    gl::VertexArrayAttribFormat(m_vao, 6, 2, gl::FLOAT, gl::FALSE_, 0);
-    gl::VertexArrayAttribBinding(m_vao, 6, 3);
-    gl::VertexArrayBindingDivisor(m_vao, 3, 1);
-    gl::EnableVertexArrayAttrib(m_vao, 6);
+    gl::VertexArrayAttribFormat(vao, 6, 2, gl::FLOAT, gl::FALSE_, 0);
+    gl::VertexArrayAttribBinding(vao, 6, 3);
+    gl::VertexArrayBindingDivisor(vao, 3, 1);
+    gl::EnableVertexArrayAttrib(vao, 6);
+}
+
+glm::mat4 Flock::orientation(const glm::vec2& velocity)
+{
+    return glm::rotate(glm::mat4(1.f), std::atan2(velocity.y, velocity.x), glm::vec3(0.f, 0.f, 1.f));
+}
+
+void Flock::setParams(const FlockParams& params)
+{
+    const auto target = m_selfRules.rule<SeekTarget>().target;
+    m_params = params;
+    m_wideRules = WideRules(Cohesion{params.neighbourDistance, params.cohesionWeight},
+                            Alignment{params.neighbourDistance, params.alignmentWeight});
+    m_narrowRules = NarrowRules(Separation{params.avoidanceDistance, params.separationWeight});
+    m_selfRules = SelfRules(SeekTarget{target, params.targetWeight});
+    m_wideGrid.setCellSize(m_wideRules.radius());
+    m_narrowGrid.setCellSize(narrowCellSize());
+
+    // Cached neighbourhoods were gathered with the old radii
+    m_refreshAll = true;
+}
+
+unsigned Flock::spawn(const glm::vec2& position, const glm::vec2& velocity)
+{
+    sync();
+    m_gpuStale = m_onGpu;
+
+    // The new boid's slot in the GPU's wide cache holds no sums of its own, refresh them all
+    m_refreshAll = m_refreshAll || m_onGpu;
+
+    // Only reallocate once the preallocated capacity runs out, and then double it
+    if (m_count == m_capacity)
+    {
+        reserve(std::max(2 * m_capacity, 1u));
+    }
+
+    // The new boid picks up cohesion / alignment on its next staggered refresh
+    m_positions.push_back(position);
+    m_velocities.push_back(velocity);
+    m_rotations.push_back(glm::mat4(1.f));
+    m_wideCache.emplace_back();
+    m_steering.emplace_back(0.f);
+    m_nearestWide.push_back(std::numeric_limits<float>::infinity());
+    if (m_fixedPoint)
+    {
+        m_fixedPositions.push_back(toFixed(position));
+        m_fixedVelocities.push_back(toFixed(velocity));
+        m_fixedWideCache.emplace_back();
+        m_fixedSteering.emplace_back(0);
+    }
+    return m_count++;
+}
+
+void Flock::despawn(const unsigned index)
+{
+    if (index >= m_count)
+    {
+        return;
+    }
+    sync();
+    m_gpuStale = m_onGpu;
+
+    // The GPU's wide cache is not swapped along, index would keep the removed boid's sums
+    m_refreshAll = m_refreshAll || m_onGpu;
+
+    // Swap-remove keeps every array dense without shifting the boids after index
+    const auto last = m_count - 1;
+    if (index != last)
+    {
+        m_positions[index] = m_positions[last];
+        m_velocities[index] = m_velocities[last];
+        m_rotations[index] = m_rotations[last];
+        m_wideCache[index] = m_wideCache[last];
+        m_nearestWide[index] = m_nearestWide[last];
+        if (m_fixedPoint)
+        {
+            m_fixedPositions[index] = m_fixedPositions[last];
+            m_fixedVelocities[index] = m_fixedVelocities[last];
+            m_fixedWideCache[index] = m_fixedWideCache[last];
+        }
+    }
+    m_positions.pop_back();
+    m_velocities.pop_back();
+    m_rotations.pop_back();
+    m_wideCache.pop_back();
+    m_steering.pop_back();
+    m_nearestWide.pop_back();
+    if (m_fixedPoint)
+    {
+        m_fixedPositions.pop_back();
+        m_fixedVelocities.pop_back();
+        m_fixedWideCache.pop_back();
+        m_fixedSteering.pop_back();
+    }
+    --m_count;
+
+    // The GL buffers still hold the removed boid until the next upload, never draw more than remain
+    m_drawCount = std::min(m_drawCount, m_count);
+}
+
+void Flock::setTarget(const glm::vec2& target)
+{
+    m_selfRules.rule<SeekTarget>().target = target;
+}
+
+void Flock::setGhosts(const glm::vec2* positions, const glm::vec2* velocities, const unsigned count)
+{
+    m_ghostPositions.assign(positions, positions + count);
+    m_ghostVelocities.assign(velocities, velocities + count);
+
+    // Ghosts are appended to the boids while simulating, so the arrays need room for them too
+    if (count > m_ghostCapacity)
+    {
+        m_ghostCapacity = std::max(count, 2 * m_ghostCapacity);
+        allocateStorage(m_capacity);
+    }
+}
+
+void Flock::setThreads(const unsigned threads, const bool pin)
+{
+    m_scheduler.resize(threads, pin);
+    m_scratch.resize(m_scheduler.workers());
+    for (auto& scratch : m_scratch)
+    {
+        if (!scratch)
+        {
+            scratch = std::make_unique<WorkerScratch>();
+        }
+    }
+
+    // Histograms are per worker, and the boids should be placed near their new workers
+    allocateStorage(m_capacity);
+}
+
+void Flock::WorkerScratch::reset()
+{
+    collisions = 0;
+    nearestSum = 0;
+    nearestCount = 0;
+    headingX = 0;
+    headingY = 0;
+
+    // Give up the links' storage before the arena takes it back
+    links = std::pmr::vector<std::pair<unsigned, unsigned>>(&arena);
+    arena.reset();
+}
+
+std::size_t Flock::scratchHighWater() const
+{
+    std::size_t highWater = 0;
+    for (const auto& scratch : m_scratch)
+    {
+        highWater = std::max(highWater, scratch->arena.highWater());
+    }
+    return highWater;
 }
 
-void Flock::update(const float dt)
+void Flock::planTasks()
 {
-    double x, y;
-    glfwGetCursorPos(g_window, &x, &y);
+    m_ruleTasks.clear();
+    m_integrateTasks.clear();
+    const auto workers = m_scheduler.workers();
+    const auto entries = static_cast<unsigned>(m_wideGrid.sorted().size());
+    if (workers == 1)
+    {
+        m_ruleTasks.push_back({0, entries});
+        m_integrateTasks.push_back({0, m_count});
+        return;
+    }
 
-    constexpr float neighbourDistance = 80.f;
-    constexpr float avoidanceDistance = 6.f;
+    // Integration costs the same for every boid
+    for (unsigned first = 0; first < m_count; first += integrateChunk)
+    {
+        m_integrateTasks.push_back({first, std::min(m_count, first + integrateChunk)});
+    }
+
+    // A boid visits roughly as many neighbours as share its bucket, so a bucket of n boids
+    // costs about n * (n + 1). Consecutive buckets are packed into tasks of similar cost, a
+    // few per worker so stealing can make up for the estimate, and overfull buckets are split.
+    constexpr unsigned tasksPerWorker = 8;
+    double total = 0.0;
+    for (unsigned b = 0; b != m_wideGrid.bucketCount(); ++b)
+    {
+        const double n = m_wideGrid.bucketStart(b + 1) - m_wideGrid.bucketStart(b);
+        total += n * (n + 1.0);
+    }
+    const double target = std::max(1.0, total / (workers * tasksPerWorker));
 
+    unsigned first = 0;
+    double pending = 0.0;
+    for (unsigned b = 0; b != m_wideGrid.bucketCount(); ++b)
+    {
+        const auto begin = m_wideGrid.bucketStart(b);
+        const auto end = m_wideGrid.bucketStart(b + 1);
+        const double perBoid = end - begin + 1.0;
+        if ((end - begin) * perBoid > target)
+        {
+            if (first != begin)
+            {
+                m_ruleTasks.push_back({first, begin});
+            }
+            const auto piece = std::max(1u, static_cast<unsigned>(target / perBoid));
+            for (auto k = begin; k < end; k += piece)
+            {
+                m_ruleTasks.push_back({k, std::min(end, k + piece)});
+            }
+            first = end;
+            pending = 0.0;
+            continue;
+        }
+
+        pending += (end - begin) * perBoid;
+        if (pending >= target)
+        {
+            m_ruleTasks.push_back({first, end});
+            first = end;
+            pending = 0.0;
+        }
+    }
+    if (first != entries)
+    {
+        m_ruleTasks.push_back({first, entries});
+    }
+}
+
+void Flock::setFixedPoint(const bool fixedPoint)
+{
+    // Converting again would throw away the fixed point state, e.g. of a loaded snapshot
+    if (fixedPoint == m_fixedPoint)
+    {
+        return;
+    }
+    m_fixedPoint = fixedPoint;
+    if (fixedPoint)
+    {
+        convertToFixed();
+    }
+    m_refreshAll = true;
+}
+
+void Flock::convertToFixed()
+{
+    m_fixedPositions.resize(m_count);
+    m_fixedVelocities.resize(m_count);
+    m_fixedWideCache.assign(m_count, {});
+    m_fixedSteering.resize(m_count);
     for (unsigned i = 0; i != m_count; ++i)
     {
-        // Rule Vectors
-        // v1 - Cohesion
-        // v2 - Alignment
-        // v3 - Separation
-        // v4 - Target Location
-        glm::vec2 v1, v2, v3, v4;
-        v4 = (glm::vec2(static_cast<float>(x), static_cast<float>(y)) - m_positions[i]) * 0.005f;
+        m_fixedPositions[i] = toFixed(m_positions[i]);
+        m_fixedVelocities[i] = toFixed(m_velocities[i]);
+    }
+}
+
+FixedRules Flock::fixedRules() const
+{
+    const auto squared = [](const float range) {
+        const std::int64_t r = toFixed(range);
+        return r * r;
+    };
+    return FixedRules{squared(m_params.neighbourDistance),
+                      squared(m_params.avoidanceDistance),
+                      toFixed(m_params.cohesionWeight),
+                      toFixed(m_params.alignmentWeight),
+                      toFixed(m_params.separationWeight),
+                      toFixed(m_params.targetWeight),
+                      toFixed(10.f),
+                      toFixed(m_selfRules.rule<SeekTarget>().target)};
+}
+
+void Flock::simulateFixed(const std::function<void()>& meanwhile)
+{
+    // Same passes as simulate(). The grids are built from the float positions, which are
+    // converted from the fixed ones and so the same everywhere; they only pick candidates, every
+    // test on them is done in fixed point.
+    m_positions.insert(m_positions.end(), m_ghostPositions.begin(), m_ghostPositions.end());
+    for (unsigned g = 0; g != m_ghostPositions.size(); ++g)
+    {
+        m_fixedPositions.push_back(toFixed(m_ghostPositions[g]));
+        m_fixedVelocities.push_back(toFixed(m_ghostVelocities[g]));
+    }
+    const auto entries = static_cast<unsigned>(m_positions.size());
+    m_wideGrid.build(m_positions.data(), entries, &m_scheduler);
+    m_narrowGrid.build(m_positions.data(), entries, &m_scheduler);
+
+    const auto stride = std::max(m_params.wideRuleStride, 1u);
+    const auto phase = m_tick % stride;
+    const bool refreshAll = m_refreshAll;
+    m_refreshAll = false;
+    planTasks();
 
-        // Identify neighbours in a 360 degree FOV
-        std::vector<std::size_t> neighbours;
-        for (unsigned j = 0; j != m_count; ++j)
+    const auto rules = fixedRules();
+    const auto& sorted = m_wideGrid.sorted();
+    auto evaluate = [&](const TaskRange& range, unsigned) {
+        for (auto k = range.first; k != range.last; ++k)
         {
-            const auto diff = m_positions[j] - m_positions[i];
-            if (j != i && glm::length(diff) < neighbourDistance)
+            const auto i = sorted[k];
+            if (i >= m_count)
             {
-                const auto& v = m_velocities[i];
-                const float angle = glm::acos(glm::dot(v, diff) / (glm::length(v) * glm::length(diff)));
-                if (angle < 45.f * 3.1415f / 180.f)
-                {
-                    neighbours.push_back(j);
-                }
+                continue;
+            }
+            if (refreshAll || i % stride == phase)
+            {
+                m_fixedWideCache[i] = {};
+                rules.gatherWide(m_fixedWideCache[i], i, m_wideGrid, m_positions.data(), m_fixedPositions.data(),
+                                 m_fixedVelocities.data());
+            }
+            const auto narrow =
+                rules.gatherNarrow(i, m_narrowGrid, m_positions.data(), m_fixedPositions.data(), m_fixedVelocities.data());
+            m_fixedSteering[i] = rules.finalize(m_fixedWideCache[i], narrow, m_fixedPositions[i], m_fixedVelocities[i]);
+        }
+    };
+    m_scheduler.start(m_ruleTasks, evaluate);
+    if (meanwhile)
+    {
+        meanwhile();
+    }
+    m_scheduler.finish();
+
+    m_positions.resize(m_count);
+    m_fixedPositions.resize(m_count);
+    m_fixedVelocities.resize(m_count);
+
+    const bool culling = m_vao != 0 && cullsOnCpu();
+    if (culling)
+    {
+        prepareVisible();
+    }
+    m_scheduler.run(m_integrateTasks, [&](const TaskRange& range, unsigned) {
+        auto visible = range.first;
+        for (unsigned i = range.first; i != range.last; ++i)
+        {
+            rules.integrate(m_fixedPositions[i], m_fixedVelocities[i], m_fixedSteering[i]);
+            m_positions[i] = fromFixed(m_fixedPositions[i]);
+            m_velocities[i] = fromFixed(m_fixedVelocities[i]);
+            if (culling)
+            {
+                appendVisible(i, visible);
+            }
+            else
+            {
+                m_rotations[i] = orientation(m_velocities[i]);
+            }
+        }
+        if (culling)
+        {
+            m_visibleChunks[range.first / integrateChunk] = {range.first, visible};
+        }
+    });
+    if (culling)
+    {
+        uploadVisible();
+    }
+    else if (m_vao != 0)
+    {
+        upload();
+    }
+}
+
+bool Flock::setGpu(const bool gpu)
+{
+    if (!gpu)
+    {
+        sync();
+        m_onGpu = false;
+        m_refreshAll = true;
+        return true;
+    }
+
+    if (m_vao == 0)
+    {
+        std::cout << "The GPU backend needs draw data!\n";
+        return false;
+    }
+    if (!m_gpu)
+    {
+        m_gpu = std::make_unique<GpuSimulation>();
+        if (!m_gpu->create())
+        {
+            m_gpu.reset();
+            return false;
+        }
+    }
+    m_onGpu = true;
+    m_gpuStale = true;
+    m_refreshAll = true;
+    return true;
+}
+
+void Flock::sync()
+{
+    if (!m_gpuAhead)
+    {
+        return;
+    }
+    gl::GetNamedBufferSubData(m_pvbo, 0, sizeof(glm::vec2) * m_count, m_positions.data());
+    gl::GetNamedBufferSubData(m_vvbo, 0, sizeof(glm::vec2) * m_count, m_velocities.data());
+    gl::GetNamedBufferSubData(m_rvbo, 0, sizeof(glm::mat4) * m_count, m_rotations.data());
+    m_gpuAhead = false;
+}
+
+void Flock::simulateGpu(const std::function<void()>& meanwhile)
+{
+    if (m_gpuStale)
+    {
+        upload();
+        m_gpuStale = false;
+    }
+
+    const auto stride = std::max(m_params.wideRuleStride, 1u);
+    const GpuTick tick{m_count,
+                       m_params.neighbourDistance,
+                       m_params.avoidanceDistance,
+                       m_params.cohesionWeight,
+                       m_params.alignmentWeight,
+                       m_params.separationWeight,
+                       m_params.targetWeight,
+                       m_selfRules.rule<SeekTarget>().target,
+                       stride,
+                       m_tick % stride,
+                       m_refreshAll};
+    m_refreshAll = false;
+    m_gpu->step(tick, m_pvbo, m_vvbo, m_rvbo);
+    m_gpuAhead = true;
+    m_drawCount = m_count;
+
+    // Queued behind the dispatches, so this draws the new tick
+    if (meanwhile)
+    {
+        meanwhile();
+    }
+}
+
+void Flock::setMetrics(const unsigned flags)
+{
+    m_metricFlags = flags & MetricAll;
+    m_metrics = {};
+}
+
+template <unsigned Metrics>
+void Flock::simulate(const std::function<void()>& meanwhile)
+{
+    constexpr bool order = Metrics & MetricOrder;
+    constexpr bool clusters = Metrics & MetricClusters;
+    constexpr bool nearest = Metrics & MetricNearestNeighbour;
+    constexpr bool collisions = Metrics & MetricCollisions;
+    constexpr float infinity = std::numeric_limits<float>::infinity();
+
+    // Rules read the state at the start of the tick, which is what both grids are built from.
+    // The resulting steering is only applied to the boids once every rule has been evaluated.
+    // Ghost boids are appended for the duration of the rule pass, so that they are found as
+    // neighbours without ever being steered or integrated themselves
+    m_positions.insert(m_positions.end(), m_ghostPositions.begin(), m_ghostPositions.end());
+    m_velocities.insert(m_velocities.end(), m_ghostVelocities.begin(), m_ghostVelocities.end());
+    const auto entries = static_cast<unsigned>(m_positions.size());
+    m_wideGrid.build(m_positions.data(), entries, &m_scheduler);
+    m_narrowGrid.build(m_positions.data(), entries, &m_scheduler);
+
+    // Cohesion and alignment change slowly, so only a round-robin subset of boids re-evaluates
+    // them against the wide neighbourhood each tick. Everyone does so on the first tick and whenever
+    // parameters or state have been replaced.
+    const auto stride = std::max(m_params.wideRuleStride, 1u);
+    const auto phase = m_tick % stride;
+    const bool refreshAll = m_refreshAll;
+    m_refreshAll = false;
+
+    // Cluster links are collected over one full round of wide refreshes
+    if constexpr (clusters)
+    {
+        if (refreshAll || phase == 0 || m_clusters.size() != m_count)
+        {
+            m_clusters.reset(m_count);
+        }
+    }
+    const bool serial = m_scheduler.workers() == 1;
+    for (auto& scratch : m_scratch)
+    {
+        scratch->reset();
+    }
+    planTasks();
+
+    // Every boid only writes its own entries, anything shared goes through the worker's scratch
+    const auto rules = [&](const unsigned i, WorkerScratch& scratch) {
+        const Boid self{m_positions[i], m_velocities[i]};
+
+        // Refresh the cached wide neighbourhood of this boid if it is its turn
+        if (refreshAll || i % stride == phase)
+        {
+            float nearestWide = infinity;
+            m_wideCache[i] = {};
+            m_wideRules.gather(m_wideCache[i], i, m_wideGrid, m_positions, m_velocities,
+                               [&](const unsigned j, const float distance) {
+                                   if constexpr (nearest)
+                                   {
+                                       nearestWide = std::min(nearestWide, distance);
+                                   }
+                                   if constexpr (clusters)
+                                   {
+                                       if (j < m_count && distance < m_params.neighbourDistance)
+                                       {
+                                           if (serial)
+                                           {
+                                               m_clusters.unite(i, j);
+                                           }
+                                           else
+                                           {
+                                               scratch.links.emplace_back(i, j);
+                                           }
+                                       }
+                                   }
+                               });
+            if constexpr (nearest)
+            {
+                m_nearestWide[i] = nearestWide < m_params.neighbourDistance ? nearestWide : infinity;
             }
         }
 
-        // For each neighbour of current Boid
-        for (auto& j : neighbours)
+        // Separation is gathered every tick, but only needs the narrow grid
+        float nearestNarrow = infinity;
+        NarrowRules::Accumulators narrow{};
+        m_narrowRules.gather(narrow, i, m_narrowGrid, m_positions, m_velocities,
+                             [&](const unsigned j, const float distance) {
+                                 if constexpr (nearest)
+                                 {
+                                     nearestNarrow = std::min(nearestNarrow, distance);
+                                 }
+                                 if constexpr (collisions)
+                                 {
+                                     scratch.collisions += j > i && j < m_count && distance < collisionDistance;
+                                 }
+                             });
+
+        // The narrow pass is exact for close boids, sparser boids fall back to the last wide pass
+        if constexpr (nearest)
         {
-            // Cohesion
-            v1 += m_positions[j];
+            const float d = std::min(nearestNarrow, m_nearestWide[i]);
+            if (d != infinity)
+            {
+                scratch.nearestSum += toFixed(d);
+                ++scratch.nearestCount;
+            }
+        }
 
-            // Alignment
-            v2 += m_velocities[j];
+        m_steering[i] = m_wideRules.finalize(m_wideCache[i], self) + m_narrowRules.finalize(narrow, self) +
+                        m_selfRules.finalize({}, self);
+    };
 
-            // Avoidance
-            if (glm::length(m_positions[j] - m_positions[i]) < avoidanceDistance)
+    // Boids are visited in wide grid order, which keeps neighbours in cache and lets tasks be
+    // whole buckets. Ghosts are in the grid too but are not simulated here.
+    const auto& sorted = m_wideGrid.sorted();
+    auto evaluate = [&](const TaskRange& range, const unsigned worker) {
+        for (auto k = range.first; k != range.last; ++k)
+        {
+            if (sorted[k] < m_count)
             {
-                v3 = v3 - (m_positions[i] - m_positions[j]);
+                rules(sorted[k], *m_scratch[worker]);
             }
         }
+    };
+    m_scheduler.start(m_ruleTasks, evaluate);
+    if (meanwhile)
+    {
+        meanwhile();
+    }
+    m_scheduler.finish();
+
+    m_positions.resize(m_count);
+    m_velocities.resize(m_count);
+
+    // With draw data and more than one worker, this thread (which owns the GL context) uploads
+    // each integrated chunk as soon as it is done instead of waiting for the whole flock
+    // When culling, integration also compacts the visible boids of each chunk, and only those
+    // are uploaded
+    const bool overlapUpload = m_vao != 0 && !serial;
+    const bool culling = m_vao != 0 && cullsOnCpu();
+    const auto chunks = static_cast<unsigned>(m_integrateTasks.size());
+    if (culling)
+    {
+        prepareVisible();
+    }
+    if (overlapUpload)
+    {
+        if (m_count > m_bufferCapacity)
+        {
+            createInstanceBuffers(std::max(m_count, 2 * m_bufferCapacity));
+        }
+        if (m_chunkDone.size() != chunks)
+        {
+            m_chunkDone = std::vector<std::atomic<bool>>(chunks);
+        }
+        for (auto& done : m_chunkDone)
+        {
+            done.store(false, std::memory_order_relaxed);
+        }
+    }
 
-        // Cohesion
-        v1 *= 1.f / neighbours.size();  // Since glm::vec2 does not support division
-        v1 = (v1 - m_positions[i]) * 0.01f;
+    auto integrate = [&](const TaskRange& range, const unsigned worker) {
+        std::int64_t headingX = 0, headingY = 0;
+        auto visible = range.first;
+        for (unsigned i = range.first; i != range.last; ++i)
+        {
+            // Apply velocities
+            m_velocities[i] += m_steering[i];
+
+            // Constrain top speed
+            const float speed = glm::length(m_velocities[i]);
+            if (speed > 10.f)
+            {
+                m_velocities[i] = glm::normalize(m_velocities[i]) * 10.f;
+            }
 
-        // Alignment
-        v2 *= 1.f / neighbours.size();  // Ditto
-        v2 = (v2 - m_velocities[i]) * 0.125f;
+            if constexpr (order)
+            {
+                if (speed > 0.f)
+                {
+                    const auto heading = toFixed(m_velocities[i] * (1.f / std::min(speed, 10.f)));
+                    headingX += heading.x;
+                    headingY += heading.y;
+                }
+            }
 
-        // Apply velocities
-        m_velocities[i] += (v1 + v2 + v3 + v4);
+            // Apply movement
+            m_positions[i] += m_velocities[i];
 
-        // Constrain top speed
-        if (glm::length(m_velocities[i]) > 10.f)
+            // Compute orientation of boid, or only of the boids on screen when culling
+            if (culling)
+            {
+                appendVisible(i, visible);
+            }
+            else
+            {
+                m_rotations[i] = orientation(m_velocities[i]);
+            }
+        }
+        m_scratch[worker]->headingX += headingX;
+        m_scratch[worker]->headingY += headingY;
+        if (culling)
+        {
+            m_visibleChunks[range.first / integrateChunk] = {range.first, visible};
+        }
+        if (overlapUpload)
+        {
+            m_chunkDone[range.first / integrateChunk].store(true, std::memory_order_release);
+        }
+    };
+    m_scheduler.start(m_integrateTasks, integrate);
+    unsigned drawn = 0;
+    if (overlapUpload)
+    {
+        // Upload in order as chunks complete, helping with the integration whenever the next
+        // chunk is not ready yet. Visible boids are packed back to back in the GL buffers.
+        for (unsigned c = 0; c != chunks;)
+        {
+            if (m_chunkDone[c].load(std::memory_order_acquire))
+            {
+                if (culling)
+                {
+                    const auto& chunk = m_visibleChunks[c];
+                    uploadVisibleRange(chunk.first, chunk.last, drawn);
+                    drawn += chunk.last - chunk.first;
+                }
+                else
+                {
+                    uploadRange(m_integrateTasks[c].first, m_integrateTasks[c].last);
+                    drawn = m_integrateTasks[c].last;
+                }
+                ++c;
+            }
+            else if (!m_scheduler.help())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    m_scheduler.finish();
+    if (overlapUpload)
+    {
+        m_drawCount = drawn;
+    }
+    else if (culling)
+    {
+        uploadVisible();
+    }
+    else if (m_vao != 0)
+    {
+        upload();
+    }
+
+    // Merge the per worker results
+    std::int64_t headingX = 0, headingY = 0;
+    unsigned collisionCount = 0;
+    std::int64_t nearestSum = 0;
+    unsigned nearestCount = 0;
+    for (const auto& scratch : m_scratch)
+    {
+        headingX += scratch->headingX;
+        headingY += scratch->headingY;
+        collisionCount += scratch->collisions;
+        nearestSum += scratch->nearestSum;
+        nearestCount += scratch->nearestCount;
+        if constexpr (clusters)
+        {
+            for (const auto& [i, j] : scratch->links)
+            {
+                m_clusters.unite(i, j);
+            }
+        }
+    }
+
+    // Publish the enabled metrics
+    if constexpr (order)
+    {
+        const glm::dvec2 heading(static_cast<double>(headingX), static_cast<double>(headingY));
+        m_metrics.orderParameter = m_count != 0 ? static_cast<float>(glm::length(heading) / fixedOne / m_count) : 0.f;
+    }
+    if constexpr (clusters)
+    {
+        // Only complete once every boid has contributed its links
+        if (refreshAll || phase == stride - 1)
         {
-            m_velocities[i] = glm::normalize(m_velocities[i]) * 10.f;
+            m_metrics.clusterCount = m_clusters.count();
         }
+    }
+    if constexpr (nearest)
+    {
+        m_metrics.meanNearestNeighbour =
+            nearestCount != 0 ? static_cast<float>(static_cast<double>(nearestSum) / fixedOne / nearestCount) : 0.f;
+    }
+    if constexpr (collisions)
+    {
+        m_metrics.collisions = collisionCount;
+    }
+}
+
+template <unsigned... Flags>
+constexpr std::array<Flock::Kernel, sizeof...(Flags)> Flock::kernels(std::integer_sequence<unsigned, Flags...>)
+{
+    return {&Flock::simulate<Flags>...};
+}
 
-        // Apply movement
-        m_positions[i] += m_velocities[i];
+void Flock::update(const float dt, const std::function<void()>& meanwhile)
+{
+    // Headless flocks (m_vao == 0) skip uploading altogether
+    static constexpr auto table = kernels(std::make_integer_sequence<unsigned, MetricAll + 1>{});
+    if (m_onGpu)
+    {
+        simulateGpu(meanwhile);
+    }
+    else if (m_fixedPoint)
+    {
+        simulateFixed(meanwhile);
+    }
+    else
+    {
+        (this->*table[m_metricFlags])(meanwhile);
+    }
+    ++m_tick;
+}
 
-        // Compute orientation of boid
-        m_rotations[i] = glm::rotate(glm::mat4(1.f), std::atan2(m_velocities[i].y, m_velocities[i].x),
-                                     glm::vec3(0.f, 0.f, 1.f));
+void Flock::setFrame(const glm::vec2* positions, const glm::vec2* velocities, const unsigned count,
+                     const unsigned tick)
+{
+    reserve(count);
+    m_positions.assign(positions, positions + count);
+    m_velocities.assign(velocities, velocities + count);
+    m_rotations.resize(count);
+    m_wideCache.assign(count, {});
+    m_steering.resize(count);
+    m_nearestWide.assign(count, std::numeric_limits<float>::infinity());
+    for (unsigned i = 0; i != count; ++i)
+    {
+        m_rotations[i] = orientation(m_velocities[i]);
     }
 
+    m_count = count;
+    m_tick = tick;
+    m_refreshAll = true;
+    m_gpuAhead = false;
+    if (m_fixedPoint)
+    {
+        convertToFixed();
+    }
+    if (m_vao != 0)
+    {
+        upload();
+    }
+}
+
+void Flock::upload()
+{
+    // Grow the GL buffers geometrically if boids were spawned beyond their capacity
+    if (m_count > m_bufferCapacity)
+    {
+        createInstanceBuffers(std::max(m_count, 2 * m_bufferCapacity));
+    }
+
+    // State set from outside has no compacted chunks yet, so compact it here in one go
+    if (cullsOnCpu())
+    {
+        prepareVisible();
+        unsigned visible = 0;
+        for (unsigned i = 0; i != m_count; ++i)
+        {
+            appendVisible(i, visible);
+        }
+        m_visibleChunks.assign(1, {0, visible});
+        uploadVisible();
+        return;
+    }
+
+    uploadRange(0, m_count);
+    m_drawCount = m_count;
+}
+
+void Flock::uploadRange(const unsigned first, const unsigned last)
+{
     // Fill GL Buffers with data for accurate drawing
-    gl::NamedBufferSubData(m_vvbo, 0, sizeof(glm::vec2) * m_count, m_velocities.data());
-    gl::NamedBufferSubData(m_pvbo, 0, sizeof(glm::vec2) * m_count, m_positions.data());
-    gl::NamedBufferSubData(m_rvbo, 0, sizeof(glm::mat4) * m_count, m_rotations.data());
+    TimedScope timed(m_uploadTimer);
+    const auto n = last - first;
+    gl::NamedBufferSubData(m_vvbo, sizeof(glm::vec2) * first, sizeof(glm::vec2) * n, m_velocities.data() + first);
+    gl::NamedBufferSubData(m_pvbo, sizeof(glm::vec2) * first, sizeof(glm::vec2) * n, m_positions.data() + first);
+    gl::NamedBufferSubData(m_rvbo, sizeof(glm::mat4) * first, sizeof(glm::mat4) * n, m_rotations.data() + first);
+}
+
+void Flock::prepareVisible()
+{
+    m_visiblePositions.resize(m_count);
+    m_visibleVelocities.resize(m_count);
+    m_visibleRotations.resize(m_count);
+    m_visibleChunks.resize(m_integrateTasks.size());
+}
+
+void Flock::uploadVisible()
+{
+    if (m_count > m_bufferCapacity)
+    {
+        createInstanceBuffers(std::max(m_count, 2 * m_bufferCapacity));
+    }
+
+    unsigned drawn = 0;
+    for (const auto& chunk : m_visibleChunks)
+    {
+        uploadVisibleRange(chunk.first, chunk.last, drawn);
+        drawn += chunk.last - chunk.first;
+    }
+    m_drawCount = drawn;
+}
+
+void Flock::uploadVisibleRange(const unsigned first, const unsigned last, const unsigned offset)
+{
+    TimedScope timed(m_uploadTimer);
+    const auto n = last - first;
+    gl::NamedBufferSubData(m_vvbo, sizeof(glm::vec2) * offset, sizeof(glm::vec2) * n, m_visibleVelocities.data() + first);
+    gl::NamedBufferSubData(m_pvbo, sizeof(glm::vec2) * offset, sizeof(glm::vec2) * n, m_visiblePositions.data() + first);
+    gl::NamedBufferSubData(m_rvbo, sizeof(glm::mat4) * offset, sizeof(glm::mat4) * n, m_visibleRotations.data() + first);
+}
+
+void Flock::setVisibleArea(const glm::vec2& min, const glm::vec2& max)
+{
+    m_culling = true;
+    m_visibleMin = min - glm::vec2(boidRadius);
+    m_visibleMax = max + glm::vec2(boidRadius);
+}
+
+void Flock::clearVisibleArea()
+{
+    m_culling = false;
+}
+
+bool Flock::setGpuCulling(const bool gpuCulling)
+{
+    if (!gpuCulling)
+    {
+        m_cullOnGpu = false;
+        return true;
+    }
+
+    if (m_vao == 0)
+    {
+        std::cout << "GPU culling needs draw data!\n";
+        return false;
+    }
+    if (!m_gpuCulling)
+    {
+        m_gpuCulling = std::make_unique<GpuCulling>();
+        if (!m_gpuCulling->create())
+        {
+            m_gpuCulling.reset();
+            return false;
+        }
+        createVertexArray(m_culledVao);
+    }
+    m_cullOnGpu = true;
+    return true;
+}
+
+unsigned Flock::drawCount() const
+{
+    if (m_culling && m_cullOnGpu)
+    {
+        return m_gpuCulling->visibleCount();
+    }
+    return m_drawCount;
 }
 
 void Flock::draw()
 {
-    // Bind and draw m_count number of instanced boids
+    // Boids a few pixels across look the same as a point of that size
+    const float size = 2.f * boidRadius * m_pixelsPerUnit;
+    const bool points = size < pointThreshold;
+
+    // Culling on the GPU leaves the boids to draw, and how many, in buffers of its own
+    const bool indirect = m_culling && m_cullOnGpu;
+    auto positions = m_pvbo, velocities = m_vvbo;
+    if (indirect)
+    {
+        m_gpuCulling->cull(m_drawCount, m_pvbo, m_vvbo, m_rvbo, m_visibleMin, m_visibleMax, points);
+        gl::BindBuffer(gl::DRAW_INDIRECT_BUFFER, m_gpuCulling->command());
+        positions = m_gpuCulling->positions();
+        velocities = m_gpuCulling->velocities();
+    }
+
+    if (points)
+    {
+        // One vertex per boid, attached every time since the buffers are replaced when they grow
+        gl::VertexArrayVertexBuffer(m_pointVao, 0, positions, 0, sizeof(glm::vec2));
+        gl::VertexArrayVertexBuffer(m_pointVao, 3, velocities, 0, sizeof(glm::vec2));
+        gl::BindVertexArray(m_pointVao);
+        gl::PointSize(std::max(size, 1.f));
+        if (indirect)
+        {
+            gl::DrawArraysIndirect(gl::POINTS, nullptr);
+        }
+        else
+        {
+            gl::DrawArrays(gl::POINTS, 0, m_drawCount);
+        }
+        return;
+    }
+
+    if (indirect)
+    {
+        // The visible boids' buffers are replaced when they grow, so attach them every time
+        gl::VertexArrayVertexBuffer(m_culledVao, 0, positions, 0, sizeof(glm::vec2));
+        gl::VertexArrayVertexBuffer(m_culledVao, 2, m_gpuCulling->rotations(), 0, sizeof(glm::mat4));
+        gl::VertexArrayVertexBuffer(m_culledVao, 3, velocities, 0, sizeof(glm::vec2));
+
+        // Draw as many instances as the pass left in the command
+        gl::BindVertexArray(m_culledVao);
+        gl::DrawArraysIndirect(gl::TRIANGLES, nullptr);
+        return;
+    }
+
+    // Bind and draw the instanced boids of the last upload
     gl::BindVertexArray(m_vao);
-    gl::DrawArraysInstanced(gl::TRIANGLES, 0, 3, m_count);
+    gl::DrawArraysInstanced(gl::TRIANGLES, 0, 3, m_drawCount);
 }
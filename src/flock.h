@@ -1,38 +1,350 @@
 #ifndef FLOCK_H
 #define FLOCK_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "fixed.h"
 #include "glm/glm.hpp"
+#include "gpu_culling.h"
+#include "gpu_simulation.h"
+#include "grid.h"
+#include "memory.h"
+#include "metrics.h"
+#include "rules.h"
+#include "scheduler.h"
+#include "timing.h"
+
+// Rules evaluated over the wide neighbourhood for a staggered subset of boids each tick
+using WideRules = RulePipeline<Cohesion, Alignment>;
+
+// Rules evaluated over the narrow neighbourhood for every boid each tick
+using NarrowRules = RulePipeline<Separation>;
+
+// Rules that only look at the boid itself
+using SelfRules = RulePipeline<SeekTarget>;
+
+// Tunable parameters of a flock. Kept trivially copyable since snapshots store it verbatim.
+struct FlockParams
+{
+    // Radius of the cohesion / alignment neighbourhood
+    float neighbourDistance = 80.f;
+
+    // Radius within which boids actively steer away from each other
+    float avoidanceDistance = 6.f;
+
+    // Rule weights
+    float cohesionWeight = 0.01f;
+    float alignmentWeight = 0.125f;
+    float separationWeight = 1.f;
+    float targetWeight = 0.005f;
+
+    // Cohesion and alignment are refreshed for one in this many boids per tick
+    unsigned wideRuleStride = 4;
+
+    // Seed for the initial conditions, 0 draws one from std::random_device
+    std::uint32_t seed = 0;
+};
+
+// std::mt19937 that counts the values it has produced. The standard fully specifies the sequence
+// of a seeded std::mt19937, so its seed and that count pin down its state on any library, which
+// std::mt19937 itself does not expose other than as text.
+class CountingGenerator
+{
+private:
+    std::mt19937 m_engine;
+    std::uint32_t m_seed;
+    std::uint64_t m_draws = 0;
+
+public:
+    using result_type = std::mt19937::result_type;
+
+    explicit CountingGenerator(const std::uint32_t seed) : m_engine(seed), m_seed(seed) {}
+
+    static constexpr result_type min() { return std::mt19937::min(); }
+    static constexpr result_type max() { return std::mt19937::max(); }
+
+    result_type operator()()
+    {
+        ++m_draws;
+        return m_engine();
+    }
+
+    std::uint32_t seed() const { return m_seed; }
+    std::uint64_t draws() const { return m_draws; }
+
+    // Return to the state after draws values were produced from seed
+    void restore(const std::uint32_t seed, const std::uint64_t draws)
+    {
+        m_engine.seed(seed);
+        m_engine.discard(draws);
+        m_seed = seed;
+        m_draws = draws;
+    }
+};
 
 class Flock
 {
 private:
+    // Backs the per boid and grid arrays below, so it is declared (and destroyed) first
+    std::unique_ptr<Arena> m_arena;
+
     // Positions
-    std::vector<glm::vec2> m_positions;
+    BoidArray<glm::vec2> m_positions;
 
     // Velocities
-    std::vector<glm::vec2> m_velocities;
+    BoidArray<glm::vec2> m_velocities;
+
+    // Rotation Matrices. Not kept up to date by ticks on the CPU while culling, which only
+    // orient the visible boids, in m_visibleRotations
+    BoidArray<glm::mat4> m_rotations;
+
+    // Cached wide rule accumulators. These are only refreshed for a staggered subset of boids
+    // each tick, but finalized against the current state of every boid (see Flock::update)
+    BoidArray<WideRules::Accumulators> m_wideCache;
+
+    // Velocity change of each boid this tick, applied once all rules have been evaluated
+    BoidArray<glm::vec2> m_steering;
+
+    // Boids owned by someone else that this flock's boids should still react to
+    std::vector<glm::vec2> m_ghostPositions;
+    std::vector<glm::vec2> m_ghostVelocities;
+
+    // Parameters the rule pipelines were built from
+    FlockParams m_params;
 
-    // Rotation Matrices
-    std::vector<glm::mat4> m_rotations;
+    // Rule pipelines
+    WideRules m_wideRules;
+    NarrowRules m_narrowRules;
+    SelfRules m_selfRules;
+
+    // Grids sized to the radius of the wide and narrow rules. The narrow grid also finds every
+    // pair the collision metric counts, even with an avoidance distance below collisionDistance.
+    Grid m_wideGrid, m_narrowGrid;
+
+    float narrowCellSize() const { return std::max(m_narrowRules.radius(), collisionDistance); }
 
     // Number of boids
     unsigned m_count;
 
-    // Vertex array for boid drawing
-    unsigned m_vao;
+    // Number of boids the per boid arrays have room for before they must reallocate
+    unsigned m_capacity;
+
+    // Number of ghosts the arrays they are appended to, and the grids, have room for on top of
+    // m_capacity
+    unsigned m_ghostCapacity = 0;
+
+    // Number of boids the GL instance buffers have room for
+    unsigned m_bufferCapacity = 0;
+
+    // Number of ticks simulated so far, selects which boids refresh their wide rules
+    unsigned m_tick = 0;
+
+    // Set when every boid must refresh its wide rules on the next tick
+    bool m_refreshAll = true;
+
+    // Random generator for initial conditions, part of the snapshot state
+    CountingGenerator m_generator;
+
+    // Enabled metrics (MetricFlags) and their values after the last tick
+    unsigned m_metricFlags = MetricNone;
+    FlockMetrics m_metrics;
+
+    // Cluster links gathered over the current round of wide rule refreshes
+    DisjointSets m_clusters;
+
+    // Distance to the nearest boid found by the last wide refresh of each boid
+    BoidArray<float> m_nearestWide;
+
+    // Set while the flock simulates in fixed point. The fixed point arrays below are then the
+    // real state, and the float arrays above are converted from them after every tick.
+    bool m_fixedPoint = false;
+
+    // Fixed point positions, velocities, cached wide neighbourhoods and steering
+    BoidArray<FixedVec> m_fixedPositions;
+    BoidArray<FixedVec> m_fixedVelocities;
+    BoidArray<FixedWideAccumulator> m_fixedWideCache;
+    BoidArray<FixedVec> m_fixedSteering;
+
+    // Per worker partial results of a tick, merged once all workers are done
+    struct alignas(64) WorkerScratch
+    {
+        unsigned collisions = 0;
+
+        // Sums of distances and unit headings in 16.16 fixed point. Integer sums do not depend
+        // on the order they are added in, so the metrics come out the same however the boids
+        // were shared out between the workers.
+        std::int64_t nearestSum = 0;
+        unsigned nearestCount = 0;
+        std::int64_t headingX = 0, headingY = 0;
+
+        // Temporaries of the current tick
+        TickArena arena;
+
+        // Cluster links found by this worker, united afterwards since DisjointSets is not
+        // thread safe (only used with more than one worker)
+        std::pmr::vector<std::pair<unsigned, unsigned>> links{&arena};
+
+        // Drop the results and temporaries of the last tick
+        void reset();
+    };
+
+    // Workers the rule and integration passes are spread over, each with its own scratch
+    Scheduler m_scheduler;
+    std::vector<std::unique_ptr<WorkerScratch>> m_scratch;
+
+    // Ranges of the wide grid's sorted order for the rule pass, and of boid indices for integration
+    std::vector<TaskRange> m_ruleTasks, m_integrateTasks;
+
+    // Boids per integration task when there is more than one worker
+    static constexpr unsigned integrateChunk = 4096;
+
+    // Set by the worker that integrated each chunk, so it can be uploaded while others still run
+    std::vector<std::atomic<bool>> m_chunkDone;
+
+    // Set while only boids within [m_visibleMin, m_visibleMax] are uploaded and drawn. The
+    // bounds already include the size of a boid.
+    bool m_culling = false;
+    glm::vec2 m_visibleMin{0.f}, m_visibleMax{0.f};
+
+    // Furthest any vertex of the boid triangle is from the boid's position
+    static constexpr float boidRadius = 6.f;
+
+    // Visible boids, compacted within each integration chunk. Chunk c left its boids at
+    // [m_visibleChunks[c].first, m_visibleChunks[c].last) of the visible arrays.
+    BoidArray<glm::vec2> m_visiblePositions;
+    BoidArray<glm::vec2> m_visibleVelocities;
+    BoidArray<glm::mat4> m_visibleRotations;
+    std::vector<TaskRange> m_visibleChunks;
+
+    // Number of boids in the GL instance buffers, which draw() draws
+    unsigned m_drawCount = 0;
+
+    // Culls on the GPU instead, only created once setGpuCulling() enables it, and a vertex array
+    // drawing the boids it found visible
+    std::unique_ptr<GpuCulling> m_gpuCulling;
+    bool m_cullOnGpu = false;
+    unsigned m_culledVao = 0;
+
+    // Size of a world unit on screen. Boids spanning fewer than pointThreshold pixels are drawn
+    // as points, with m_pointVao, instead of triangles.
+    float m_pixelsPerUnit = 1.f;
+    static constexpr float pointThreshold = 3.f;
+    unsigned m_pointVao = 0;
+
+    // Vertex array for boid drawing, 0 until createDrawData is called
+    unsigned m_vao = 0;
 
     // Vertex Buffer Objects
     // pvbo - Position Buffer Object
     // tvbo - Triangle Buffer Object
     // rvbo - Rotation Buffer Object
     // vvbo - Velocity Buffer Object
-    unsigned m_pvbo, m_tvbo, m_rvbo, m_vvbo;
+    unsigned m_pvbo = 0, m_tvbo = 0, m_rvbo = 0, m_vvbo = 0;
+
+    // Compute shader backend, only created once setGpu() enables it
+    std::unique_ptr<GpuSimulation> m_gpu;
+    bool m_onGpu = false;
+
+    // Set when the GL buffers hold newer boids than the per boid arrays, and when the per boid
+    // arrays were changed and must be uploaded before the next tick on the GPU
+    bool m_gpuAhead = false;
+    bool m_gpuStale = false;
+
+    // Times every upload to the GL buffers if set
+    PassTimer* m_uploadTimer = nullptr;
+
+    // Create a vertex array for the boid triangle and the per instance attributes, leaving the
+    // per instance buffers for the caller to attach
+    void createVertexArray(unsigned& vao);
+
+    // (Re)create the per instance buffers with room for capacity boids and attach them to m_vao
+    void createInstanceBuffers(const unsigned capacity);
+
+    // Grow every per boid array to hold at least capacity boids
+    void reserve(const unsigned capacity);
+
+    // Bytes of arena needed for capacity boids and ghosts ghosts updated by workers threads
+    static std::size_t storageBytes(const unsigned capacity, const unsigned ghosts, const unsigned workers);
+
+    // Move every per boid and grid array into a new arena sized for capacity boids, plus
+    // m_ghostCapacity ghosts in the arrays and grids ghosts are appended to. The boids
+    // are copied by the workers that integrate each chunk, so those pages are first touched on
+    // the worker's NUMA node.
+    void allocateStorage(const unsigned capacity);
+
+    // Rotation matrix of a boid moving with velocity
+    static glm::mat4 orientation(const glm::vec2& velocity);
+
+    // Set when integration compacts the visible boids for upload
+    bool cullsOnCpu() const { return m_culling && !m_cullOnGpu && !m_onGpu; }
+
+    // Copy the per boid state into the GL instance buffers, only the visible boids when culling
+    // on the CPU
+    void upload();
+
+    // Copy boids [first, last) into the GL instance buffers, which must be large enough
+    void uploadRange(const unsigned first, const unsigned last);
+
+    // Append boid i to the visible arrays at visible and advance it, if the boid is visible. Its
+    // rotation is computed only then.
+    void appendVisible(const unsigned i, unsigned& visible)
+    {
+        const auto& p = m_positions[i];
+        if (p.x >= m_visibleMin.x && p.y >= m_visibleMin.y && p.x <= m_visibleMax.x && p.y <= m_visibleMax.y)
+        {
+            m_visiblePositions[visible] = p;
+            m_visibleVelocities[visible] = m_velocities[i];
+            m_visibleRotations[visible] = orientation(m_velocities[i]);
+            ++visible;
+        }
+    }
+
+    // Size the visible arrays and chunks for the boids about to be integrated
+    void prepareVisible();
+
+    // Copy the visible boids every chunk compacted into the GL instance buffers, back to back
+    void uploadVisible();
+
+    // Copy visible boids [first, last) to instance offset in the GL instance buffers
+    void uploadVisibleRange(const unsigned first, const unsigned last, const unsigned offset);
+
+    // Split the boids into tasks for the current number of workers
+    void planTasks();
+
+    // Replace the fixed point state with the float state, after the latter was set from outside
+    void convertToFixed();
+
+    // Rules of the fixed point mode, converted from the current parameters and target
+    FixedRules fixedRules() const;
+
+    // Body of update() in fixed point mode
+    void simulateFixed(const std::function<void()>& meanwhile);
+
+    // Body of update() on the GPU
+    void simulateGpu(const std::function<void()>& meanwhile);
+
+    // Body of update(), instantiated for every combination of MetricFlags
+    template <unsigned Metrics>
+    void simulate(const std::function<void()>& meanwhile);
+
+    using Kernel = void (Flock::*)(const std::function<void()>&);
+
+    // Table of simulate() instantiations indexed by MetricFlags
+    template <unsigned... Flags>
+    static constexpr std::array<Kernel, sizeof...(Flags)> kernels(std::integer_sequence<unsigned, Flags...>);
 
 public:
-    // Flocks are constructed with count boids
-    Flock(const std::size_t count);
+    // Flocks are constructed with count boids, and room for capacity boids before reallocating
+    Flock(const std::size_t count, const std::size_t capacity = 0, const FlockParams& params = {});
 
     // No copy-move ctor/assignment
     Flock(const Flock&) = delete;
@@ -43,14 +355,124 @@ public:
     // Clean up resources
     ~Flock();
 
-    // Create GL Draw data
+    // Create GL Draw data. Flocks without draw data simulate headless and never touch GL.
     void createDrawData();
 
-    // Update the flock
-    void update(const float dt);
+    // Add a boid and return its index. Does not allocate while count() < capacity()
+    unsigned spawn(const glm::vec2& position, const glm::vec2& velocity);
+
+    // Remove the boid at index by moving the last boid into its place. Does nothing if index is
+    // not below count().
+    void despawn(const unsigned index);
+
+    // Number of live boids
+    unsigned count() const { return m_count; }
+
+    // Number of boids that fit without reallocating
+    unsigned capacity() const { return m_capacity; }
+
+    // Memory reserved and used for the per boid and grid arrays
+    Arena::Footprint footprint() const { return m_arena->footprint(); }
+
+    // Most scratch memory any worker has needed in a single tick
+    std::size_t scratchHighWater() const;
+
+    // Per boid state, count() elements each
+    const BoidArray<glm::vec2>& positions() const { return m_positions; }
+    const BoidArray<glm::vec2>& velocities() const { return m_velocities; }
+
+    // Replace the flock parameters, rebuilding rules and grids
+    void setParams(const FlockParams& params);
+
+    const FlockParams& params() const { return m_params; }
+
+    // Number of ticks simulated so far
+    unsigned tick() const { return m_tick; }
+
+    // Write the full simulation state to a snapshot file (see snapshot.h)
+    bool saveSnapshot(const std::string& path) const;
+
+    // Replace the simulation state, including float or fixed point mode, with the contents of a
+    // snapshot file
+    bool loadSnapshot(const std::string& path);
+
+    // Replace the state with an externally produced frame (e.g. a recorded trajectory) and
+    // upload it, without simulating
+    void setFrame(const glm::vec2* positions, const glm::vec2* velocities, const unsigned count,
+                  const unsigned tick);
+
+    // Location the boids are attracted to
+    void setTarget(const glm::vec2& target);
+
+    // Boids owned elsewhere (e.g. by a neighbouring process) that act as neighbours without being
+    // simulated here. They stay until the next setGhosts() call replaces them, pass a count of 0
+    // to remove them. Not counted in count() or in any metric.
+    void setGhosts(const glm::vec2* positions, const glm::vec2* velocities, const unsigned count);
+
+    // Number of threads update() uses, including the calling one. pin binds each extra thread
+    // to its own CPU so it keeps using the memory placed on its node.
+    void setThreads(const unsigned threads, const bool pin = false);
+    unsigned threads() const { return m_scheduler.workers(); }
+
+    // Simulate in 16.16 fixed point instead of float. The same rules are evaluated with integer
+    // arithmetic only, so the boids are bit-identical on every machine, which float cannot
+    // promise across compilers and instruction sets. Metrics are not gathered in this mode, and
+    // recordings store the state converted to float. Snapshots keep the fixed point state too,
+    // and a loaded one switches to the mode it was saved in. Setting the current mode again
+    // keeps the state as it is.
+    void setFixedPoint(const bool fixedPoint);
+    bool fixedPoint() const { return m_fixedPoint; }
+
+    // Simulate with compute shaders on the GL buffers the flock is drawn from instead of on the
+    // CPU, so nothing is uploaded per tick. Needs draw data; prints the problem and returns false
+    // if it is missing or the shaders fail to compile. Metrics, ghosts and fixed point do not
+    // apply on the GPU.
+    bool setGpu(const bool gpu);
+    bool gpu() const { return m_onGpu; }
+
+    // On the GPU, positions() and velocities() are only brought up to date by this
+    void sync();
+
+    // Only upload and draw the boids that may show within the rectangle [min, max] of world
+    // space, e.g. the area the projection maps to the screen, from the next upload on. The
+    // visible boids are compacted while integrating, so boids off screen cost neither upload
+    // bandwidth nor vertex work. The GPU backend only culls with setGpuCulling().
+    void setVisibleArea(const glm::vec2& min, const glm::vec2& max);
+
+    // Upload and draw every boid again
+    void clearVisibleArea();
+
+    // Cull against the visible area with a compute pass in draw() instead, which every boid is
+    // uploaded for, and draw the boids it finds with an indirect draw. Combined with the GPU
+    // backend, no boid passes through the CPU at all. Needs draw data; prints the problem and
+    // returns false if it is missing or the shader fails to compile.
+    bool setGpuCulling(const bool gpuCulling);
+
+    // Number of boids the last draw() drew. Culling on the GPU reads it back, waiting for the GPU.
+    unsigned drawCount() const;
+
+    // Size of a world unit on screen in pixels, e.g. the framebuffer width over the width of the
+    // area the projection shows. Once boids shrink to a few pixels across, draw() switches to
+    // drawing one point per boid, which needs no instancing and a sixth of the vertex work.
+    void setPixelsPerUnit(const float pixelsPerUnit) { m_pixelsPerUnit = pixelsPerUnit; }
+
+    // Choose which metrics (MetricFlags) update() accumulates. Metrics only observe, so the
+    // boids move the same either way; those built from wide refreshes fill in over one stride.
+    void setMetrics(const unsigned flags);
+
+    // Metrics of the last tick, only the enabled ones are meaningful
+    const FlockMetrics& metrics() const { return m_metrics; }
+
+    // Update the flock. meanwhile, if given, is called on this thread while the other threads
+    // evaluate the rules, e.g. to draw and present the previous tick; it must not touch the flock
+    // other than draw(). Chunks that finish integrating are uploaded while the rest still run.
+    void update(const float dt, const std::function<void()>& meanwhile = {});
 
     // Do all necessary GL work to draw the Flock
     void draw();
+
+    // Time the uploads of boids to the GL buffers with timer from now on, none if null
+    void setUploadTimer(PassTimer* timer) { m_uploadTimer = timer; }
 };
 
 #endif // FLOCK_H
@@ -0,0 +1,161 @@
+#include "gpu_culling.h"
+
+#include <algorithm>
+
+#include "gl_core4_5.hpp"
+#include "gpu_simulation.h"
+
+namespace
+{
+const char* cullSource = R"(#version 450 core
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) readonly buffer Positions { vec2 positions[]; };
+layout(std430, binding = 1) readonly buffer Velocities { vec2 velocities[]; };
+layout(std430, binding = 2) readonly buffer Rotations { mat4 rotations[]; };
+layout(std430, binding = 3) writeonly buffer VisiblePositions { vec2 visiblePositions[]; };
+layout(std430, binding = 4) writeonly buffer VisibleVelocities { vec2 visibleVelocities[]; };
+layout(std430, binding = 5) writeonly buffer VisibleRotations { mat4 visibleRotations[]; };
+layout(std430, binding = 6) buffer Command { uint command[4]; };
+
+uniform uint count;
+uniform vec2 visibleMin;
+uniform vec2 visibleMax;
+
+// Field of the command that counts the visible boids, 1 for instances of the triangle and 0 for
+// point vertices, which need no rotation
+uniform uint counted;
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= count)
+    {
+        return;
+    }
+
+    vec2 p = positions[i];
+    if (all(greaterThanEqual(p, visibleMin)) && all(lessThanEqual(p, visibleMax)))
+    {
+        uint k = atomicAdd(command[counted], 1u);
+        visiblePositions[k] = p;
+        visibleVelocities[k] = velocities[i];
+        if (counted == 1u)
+        {
+            visibleRotations[k] = rotations[i];
+        }
+    }
+})";
+
+// Layout of a DrawArraysIndirect command
+struct DrawArraysIndirectCommand
+{
+    unsigned count;
+    unsigned instanceCount;
+    unsigned first;
+    unsigned baseInstance;
+};
+} // namespace
+
+GpuCulling::~GpuCulling()
+{
+    deleteBuffers();
+    if (m_command != 0)
+    {
+        gl::DeleteBuffers(1, &m_command);
+    }
+    if (m_program != 0)
+    {
+        gl::DeleteProgram(m_program);
+    }
+}
+
+bool GpuCulling::create()
+{
+    m_program = compileComputePass("cull", &cullSource, 1);
+    if (m_program == 0)
+    {
+        return false;
+    }
+
+    // Nothing is visible until the first pass
+    const DrawArraysIndirectCommand command{3, 0, 0, 0};
+    gl::CreateBuffers(1, &m_command);
+    gl::NamedBufferStorage(m_command, sizeof(command), &command, gl::DYNAMIC_STORAGE_BIT);
+    return true;
+}
+
+void GpuCulling::createBuffers(const unsigned capacity)
+{
+    deleteBuffers();
+    m_capacity = capacity;
+
+    gl::CreateBuffers(1, &m_positions);
+    gl::NamedBufferStorage(m_positions, sizeof(glm::vec2) * capacity, nullptr, 0);
+    gl::CreateBuffers(1, &m_velocities);
+    gl::NamedBufferStorage(m_velocities, sizeof(glm::vec2) * capacity, nullptr, 0);
+    gl::CreateBuffers(1, &m_rotations);
+    gl::NamedBufferStorage(m_rotations, sizeof(glm::mat4) * capacity, nullptr, 0);
+}
+
+void GpuCulling::deleteBuffers()
+{
+    if (m_capacity == 0)
+    {
+        return;
+    }
+    for (auto* buffer : {&m_positions, &m_velocities, &m_rotations})
+    {
+        gl::DeleteBuffers(1, buffer);
+        *buffer = 0;
+    }
+    m_capacity = 0;
+}
+
+void GpuCulling::cull(const unsigned count, const unsigned positions, const unsigned velocities,
+                      const unsigned rotations, const glm::vec2& min, const glm::vec2& max, const bool points)
+{
+    if (count > m_capacity)
+    {
+        createBuffers(std::max(count, 2 * m_capacity));
+    }
+
+    // Start from no instances of the triangle, or one instance of no points, and let the pass
+    // count up the visible boids
+    m_points = points;
+    const auto command = points ? DrawArraysIndirectCommand{0, 1, 0, 0} : DrawArraysIndirectCommand{3, 0, 0, 0};
+    gl::NamedBufferSubData(m_command, 0, sizeof(command), &command);
+    if (count == 0)
+    {
+        return;
+    }
+
+    const unsigned bound[] = {positions, velocities, rotations, m_positions, m_velocities, m_rotations, m_command};
+    for (unsigned b = 0; b != 7; ++b)
+    {
+        gl::BindBufferBase(gl::SHADER_STORAGE_BUFFER, b, bound[b]);
+    }
+
+    gl::ProgramUniform1ui(m_program, gl::GetUniformLocation(m_program, "count"), count);
+    gl::ProgramUniform2f(m_program, gl::GetUniformLocation(m_program, "visibleMin"), min.x, min.y);
+    gl::ProgramUniform2f(m_program, gl::GetUniformLocation(m_program, "visibleMax"), max.x, max.y);
+    gl::ProgramUniform1ui(m_program, gl::GetUniformLocation(m_program, "counted"), points ? 0u : 1u);
+
+    // The draw program stays bound for the rest of the frame
+    int drawProgram = 0;
+    gl::GetIntegerv(gl::CURRENT_PROGRAM, &drawProgram);
+    gl::UseProgram(m_program);
+    gl::DispatchCompute((count + 255) / 256, 1, 1);
+
+    // Drawing and reading back come next
+    gl::MemoryBarrier(gl::COMMAND_BARRIER_BIT | gl::VERTEX_ATTRIB_ARRAY_BARRIER_BIT | gl::BUFFER_UPDATE_BARRIER_BIT);
+    gl::UseProgram(static_cast<unsigned>(drawProgram));
+}
+
+unsigned GpuCulling::visibleCount() const
+{
+    DrawArraysIndirectCommand command{};
+    gl::GetNamedBufferSubData(m_command, 0, sizeof(command), &command);
+    return m_points ? command.count : command.instanceCount;
+}
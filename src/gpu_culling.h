@@ -0,0 +1,62 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include "glm/glm.hpp"
+
+// Culls boids against a rectangle of world space with a GL 4.5 compute shader. The visible
+// boids are packed into buffers of their own along with a DrawArraysIndirect command that draws
+// them, so the number of boids in view never has to come back to the CPU. Visible boids are
+// appended with an atomic counter, so their order (and hence which of two overlapping boids is
+// drawn on top) varies between passes. Needs a current GL context.
+class GpuCulling
+{
+private:
+    unsigned m_program = 0;
+
+    // Positions, velocities and rotations of the visible boids, with room for m_capacity boids
+    unsigned m_positions = 0, m_velocities = 0, m_rotations = 0;
+    unsigned m_capacity = 0;
+
+    // DrawArraysIndirectCommand of the three vertex boid triangle, its instance count filled in
+    // by the pass, or of one vertex per boid when drawing points
+    unsigned m_command = 0;
+    bool m_points = false;
+
+    // (Re)create the visible boid buffers with room for capacity boids
+    void createBuffers(const unsigned capacity);
+    void deleteBuffers();
+
+public:
+    GpuCulling() = default;
+
+    // No copy-move ctor/assignment
+    GpuCulling(const GpuCulling&) = delete;
+    GpuCulling& operator=(const GpuCulling&) = delete;
+    GpuCulling& operator=(GpuCulling&&) = delete;
+    GpuCulling(GpuCulling&&) = delete;
+
+    ~GpuCulling();
+
+    // Compile the pass, printing any error and returning false on failure
+    bool create();
+
+    // Pack the boids among the first count of the given position, velocity and rotation buffers
+    // that lie within [min, max]. With points, the command draws them as GL_POINTS instead of
+    // instanced triangles, and rotations are not packed. The results are visible to drawing and
+    // buffer reads issued afterwards.
+    void cull(const unsigned count, const unsigned positions, const unsigned velocities, const unsigned rotations,
+              const glm::vec2& min, const glm::vec2& max, const bool points = false);
+
+    // Buffers of the visible boids, laid out like the ones passed to cull()
+    unsigned positions() const { return m_positions; }
+    unsigned velocities() const { return m_velocities; }
+    unsigned rotations() const { return m_rotations; }
+
+    // Buffer holding the DrawArraysIndirectCommand for the visible boids
+    unsigned command() const { return m_command; }
+
+    // Number of boids the last cull() found visible. Reads it back, so this waits for the pass.
+    unsigned visibleCount() const;
+};
+
+#endif // GPU_CULLING_H
@@ -0,0 +1,398 @@
+#include "gpu_simulation.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "gl_core4_5.hpp"
+
+namespace
+{
+// Buffers, uniforms and grid helpers shared by every pass
+const char* prelude = R"(#version 450 core
+
+layout(std430, binding = 0) buffer Positions { vec2 positions[]; };
+layout(std430, binding = 1) buffer Velocities { vec2 velocities[]; };
+layout(std430, binding = 2) buffer Rotations { mat4 rotations[]; };
+layout(std430, binding = 3) buffer BucketStart { uint bucketStart[]; };
+layout(std430, binding = 4) buffer Cursor { uint cursor[]; };
+layout(std430, binding = 5) buffer Sorted { uint sortedIndices[]; };
+layout(std430, binding = 6) buffer Cells { ivec2 sortedCells[]; };
+struct Wide { vec4 sums; uint count; };
+layout(std430, binding = 7) buffer WideCache { Wide wide[]; };
+layout(std430, binding = 8) buffer Steering { vec2 steering[]; };
+
+uniform uint count;
+uniform uint bucketCount;
+uniform float cellSize;
+uniform float neighbourDistance;
+uniform float avoidanceDistance;
+uniform float cohesionWeight;
+uniform float alignmentWeight;
+uniform float separationWeight;
+uniform float targetWeight;
+uniform vec2 target;
+uniform uint stride;
+uniform uint phase;
+uniform uint refreshAll;
+
+ivec2 cellOf(vec2 p) { return ivec2(floor(p / cellSize)); }
+uint bucketOf(ivec2 c) { return (uint(c.x) * 73856093u ^ uint(c.y) * 19349663u) & (bucketCount - 1u); }
+)";
+
+// Boids per bucket
+const char* countSource = R"(
+layout(local_size_x = 256) in;
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i < count)
+    {
+        atomicAdd(cursor[bucketOf(cellOf(positions[i]))], 1u);
+    }
+})";
+
+// Exclusive prefix sum of the counts into bucketStart and cursor, in a single work group: every
+// invocation sums a contiguous run of buckets, the run totals are scanned in shared memory, then
+// every invocation writes the offsets of its run
+const char* scanSource = R"(
+layout(local_size_x = 1024) in;
+shared uint totals[1024];
+void main()
+{
+    uint t = gl_LocalInvocationID.x;
+    uint per = (bucketCount + 1023u) / 1024u;
+    uint first = min(t * per, bucketCount);
+    uint last = min(first + per, bucketCount);
+    uint sum = 0u;
+    for (uint b = first; b < last; ++b)
+    {
+        sum += cursor[b];
+    }
+    totals[t] = sum;
+    barrier();
+    for (uint offset = 1u; offset < 1024u; offset <<= 1u)
+    {
+        uint before = t >= offset ? totals[t - offset] : 0u;
+        barrier();
+        totals[t] += before;
+        barrier();
+    }
+    uint running = totals[t] - sum;
+    for (uint b = first; b < last; ++b)
+    {
+        uint n = cursor[b];
+        bucketStart[b] = running;
+        cursor[b] = running;
+        running += n;
+    }
+    if (t == 0u)
+    {
+        bucketStart[bucketCount] = count;
+    }
+})";
+
+// Place every boid in its bucket
+const char* scatterSource = R"(
+layout(local_size_x = 256) in;
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i < count)
+    {
+        ivec2 cell = cellOf(positions[i]);
+        uint k = atomicAdd(cursor[bucketOf(cell)], 1u);
+        sortedIndices[k] = i;
+        sortedCells[k] = cell;
+    }
+})";
+
+// Same rules as rules.h: cohesion and alignment refreshed for a staggered subset, separation and
+// target seeking for everyone. Like inFieldOfView(), a zero vector or a cosine above one (which
+// acos() would turn into NaN on the CPU) is outside the field of view. The cosine is compared
+// with that of the angle instead, since GPU acos() implementations are often coarse.
+const char* rulesSource = R"(
+layout(local_size_x = 256) in;
+bool inFieldOfView(vec2 v, vec2 diff)
+{
+    float lengths = length(v) * length(diff);
+    if (lengths == 0.0)
+    {
+        return false;
+    }
+    float c = dot(v, diff) / lengths;
+    return c <= 1.0 && c > cos(45.0 * 3.1415 / 180.0);
+}
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= count)
+    {
+        return;
+    }
+    vec2 p = positions[i];
+    vec2 v = velocities[i];
+    bool refresh = refreshAll != 0u || i % stride == phase;
+    float range = max(neighbourDistance, avoidanceDistance);
+
+    vec4 sums = vec4(0.0);
+    uint n = 0u;
+    vec2 separation = vec2(0.0);
+    ivec2 centre = cellOf(p);
+    for (int dy = -1; dy <= 1; ++dy)
+    {
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            ivec2 cell = centre + ivec2(dx, dy);
+            uint bucket = bucketOf(cell);
+            for (uint k = bucketStart[bucket]; k != bucketStart[bucket + 1u]; ++k)
+            {
+                uint j = sortedIndices[k];
+                if (sortedCells[k] != cell || j == i)
+                {
+                    continue;
+                }
+                vec2 diff = positions[j] - p;
+                float d = length(diff);
+                if (d >= range || !inFieldOfView(v, diff))
+                {
+                    continue;
+                }
+                if (refresh && d < neighbourDistance)
+                {
+                    sums += vec4(positions[j], velocities[j]);
+                    ++n;
+                }
+                if (d < avoidanceDistance)
+                {
+                    separation += diff;
+                }
+            }
+        }
+    }
+    if (refresh)
+    {
+        wide[i] = Wide(sums, n);
+    }
+
+    Wide cached = wide[i];
+    vec2 s = separation * separationWeight + (target - p) * targetWeight;
+    if (cached.count != 0u)
+    {
+        float inverse = 1.0 / float(cached.count);
+        s += (cached.sums.xy * inverse - p) * cohesionWeight + (cached.sums.zw * inverse - v) * alignmentWeight;
+    }
+    steering[i] = s;
+})";
+
+// Apply the steering, limit the speed, move and orient every boid
+const char* integrateSource = R"(
+layout(local_size_x = 256) in;
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= count)
+    {
+        return;
+    }
+    vec2 v = velocities[i] + steering[i];
+    float speed = length(v);
+    if (speed > 10.0)
+    {
+        v = normalize(v) * 10.0;
+    }
+    velocities[i] = v;
+    positions[i] += v;
+
+    float angle = v == vec2(0.0) ? 0.0 : atan(v.y, v.x);
+    float c = cos(angle);
+    float s = sin(angle);
+    rotations[i] = mat4(c, s, 0.0, 0.0, -s, c, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.0, 1.0);
+})";
+
+// Compile and link a compute program from the prelude and body, 0 on failure
+unsigned compile(const char* name, const char* body)
+{
+    const char* sources[] = {prelude, body};
+    return compileComputePass(name, sources, 2);
+}
+
+// Hash buckets for count boids, the same as Grid uses
+unsigned bucketsFor(const unsigned count)
+{
+    unsigned buckets = 1;
+    while (buckets < count)
+    {
+        buckets <<= 1;
+    }
+    return buckets;
+}
+
+// Set the uniforms of a tick, skipping those a pass does not use
+void setUniforms(const unsigned program, const GpuTick& tick, const unsigned buckets, const bool refreshAll)
+{
+    const auto at = [&](const char* name) { return gl::GetUniformLocation(program, name); };
+    gl::ProgramUniform1ui(program, at("count"), tick.count);
+    gl::ProgramUniform1ui(program, at("bucketCount"), buckets);
+    gl::ProgramUniform1f(program, at("cellSize"), std::max(tick.neighbourDistance, tick.avoidanceDistance));
+    gl::ProgramUniform1f(program, at("neighbourDistance"), tick.neighbourDistance);
+    gl::ProgramUniform1f(program, at("avoidanceDistance"), tick.avoidanceDistance);
+    gl::ProgramUniform1f(program, at("cohesionWeight"), tick.cohesionWeight);
+    gl::ProgramUniform1f(program, at("alignmentWeight"), tick.alignmentWeight);
+    gl::ProgramUniform1f(program, at("separationWeight"), tick.separationWeight);
+    gl::ProgramUniform1f(program, at("targetWeight"), tick.targetWeight);
+    gl::ProgramUniform2f(program, at("target"), tick.target.x, tick.target.y);
+    gl::ProgramUniform1ui(program, at("stride"), std::max(tick.stride, 1u));
+    gl::ProgramUniform1ui(program, at("phase"), tick.phase);
+    gl::ProgramUniform1ui(program, at("refreshAll"), refreshAll ? 1u : 0u);
+}
+} // namespace
+
+unsigned compileComputePass(const char* name, const char* const* sources, const int count)
+{
+    const auto shader = gl::CreateShader(gl::COMPUTE_SHADER);
+    gl::ShaderSource(shader, count, sources, nullptr);
+    gl::CompileShader(shader);
+
+    int status = 0;
+    gl::GetShaderiv(shader, gl::COMPILE_STATUS, &status);
+    if (!status)
+    {
+        std::string log(4096, '\0');
+        gl::GetShaderInfoLog(shader, static_cast<int>(log.size()), nullptr, &log[0]);
+        std::cout << "Failed to compile the " << name << " pass!\n" << log.c_str() << '\n';
+        gl::DeleteShader(shader);
+        return 0;
+    }
+
+    const auto program = gl::CreateProgram();
+    gl::AttachShader(program, shader);
+    gl::LinkProgram(program);
+    gl::DeleteShader(shader);
+    gl::GetProgramiv(program, gl::LINK_STATUS, &status);
+    if (!status)
+    {
+        std::cout << "Failed to link the " << name << " pass!\n";
+        gl::DeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+GpuSimulation::~GpuSimulation()
+{
+    deleteBuffers();
+    for (const auto program :
+         {m_countProgram, m_scanProgram, m_scatterProgram, m_rulesProgram, m_integrateProgram})
+    {
+        if (program != 0)
+        {
+            gl::DeleteProgram(program);
+        }
+    }
+}
+
+bool GpuSimulation::create()
+{
+    m_countProgram = compile("count", countSource);
+    m_scanProgram = compile("scan", scanSource);
+    m_scatterProgram = compile("scatter", scatterSource);
+    m_rulesProgram = compile("rules", rulesSource);
+    m_integrateProgram = compile("integrate", integrateSource);
+    return m_countProgram != 0 && m_scanProgram != 0 && m_scatterProgram != 0 && m_rulesProgram != 0 &&
+           m_integrateProgram != 0;
+}
+
+void GpuSimulation::createBuffers(const unsigned capacity)
+{
+    deleteBuffers();
+    m_capacity = capacity;
+
+    // Wide is a vec4 and a uint, padded to 32 bytes by std430
+    const auto buckets = bucketsFor(capacity);
+    const struct
+    {
+        unsigned* buffer;
+        std::size_t bytes;
+    } buffers[] = {
+        {&m_bucketStart, sizeof(unsigned) * (buckets + 1)},
+        {&m_cursor, sizeof(unsigned) * buckets},
+        {&m_sorted, sizeof(unsigned) * capacity},
+        {&m_cells, sizeof(glm::ivec2) * capacity},
+        {&m_wideCache, 32 * static_cast<std::size_t>(capacity)},
+        {&m_steering, sizeof(glm::vec2) * capacity},
+    };
+    for (const auto& b : buffers)
+    {
+        gl::CreateBuffers(1, b.buffer);
+        gl::NamedBufferStorage(*b.buffer, b.bytes, nullptr, gl::DYNAMIC_STORAGE_BIT);
+    }
+}
+
+void GpuSimulation::deleteBuffers()
+{
+    if (m_capacity == 0)
+    {
+        return;
+    }
+    for (auto* buffer : {&m_bucketStart, &m_cursor, &m_sorted, &m_cells, &m_wideCache, &m_steering})
+    {
+        gl::DeleteBuffers(1, buffer);
+        *buffer = 0;
+    }
+    m_capacity = 0;
+}
+
+void GpuSimulation::step(const GpuTick& tick, const unsigned positions, const unsigned velocities,
+                         const unsigned rotations)
+{
+    if (tick.count == 0)
+    {
+        return;
+    }
+
+    // The cached wide neighbourhoods do not survive growing the buffers
+    bool refreshAll = tick.refreshAll;
+    if (tick.count > m_capacity)
+    {
+        createBuffers(std::max(tick.count, 2 * m_capacity));
+        refreshAll = true;
+    }
+
+    const unsigned bound[] = {positions, velocities, rotations, m_bucketStart, m_cursor,
+                              m_sorted,  m_cells,      m_wideCache, m_steering};
+    for (unsigned b = 0; b != 9; ++b)
+    {
+        gl::BindBufferBase(gl::SHADER_STORAGE_BUFFER, b, bound[b]);
+    }
+
+    // The draw program stays bound for the rest of the frame
+    int drawProgram = 0;
+    gl::GetIntegerv(gl::CURRENT_PROGRAM, &drawProgram);
+
+    const auto buckets = bucketsFor(tick.count);
+    const auto groups = (tick.count + 255) / 256;
+    const unsigned zero = 0;
+    gl::ClearNamedBufferSubData(m_cursor, gl::R32UI, 0, sizeof(unsigned) * buckets, gl::RED_INTEGER,
+                                gl::UNSIGNED_INT, &zero);
+
+    const struct
+    {
+        unsigned program;
+        unsigned groups;
+    } passes[] = {
+        {m_countProgram, groups}, {m_scanProgram, 1},      {m_scatterProgram, groups},
+        {m_rulesProgram, groups}, {m_integrateProgram, groups},
+    };
+    for (const auto& pass : passes)
+    {
+        setUniforms(pass.program, tick, buckets, refreshAll);
+        gl::UseProgram(pass.program);
+        gl::DispatchCompute(pass.groups, 1, 1);
+        gl::MemoryBarrier(gl::SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    // Drawing and reading back come next
+    gl::MemoryBarrier(gl::VERTEX_ATTRIB_ARRAY_BARRIER_BIT | gl::BUFFER_UPDATE_BARRIER_BIT);
+    gl::UseProgram(static_cast<unsigned>(drawProgram));
+}
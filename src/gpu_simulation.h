@@ -0,0 +1,66 @@
+#ifndef GPU_SIMULATION_H
+#define GPU_SIMULATION_H
+
+#include "glm/glm.hpp"
+
+// Everything a tick on the GPU needs besides the boids themselves, mirroring FlockParams and
+// the staggered refresh of the wide rules
+struct GpuTick
+{
+    unsigned count;
+    float neighbourDistance;
+    float avoidanceDistance;
+    float cohesionWeight;
+    float alignmentWeight;
+    float separationWeight;
+    float targetWeight;
+    glm::vec2 target;
+    unsigned stride;
+    unsigned phase;
+    bool refreshAll;
+};
+
+// Compile and link a compute program from count concatenated sources, printing any error and
+// returning 0 on failure. name identifies the pass in the messages.
+unsigned compileComputePass(const char* name, const char* const* sources, const int count);
+
+// Runs the grid build and the rules of a tick as GL 4.5 compute shaders, directly on the buffers
+// a Flock draws from, so nothing is uploaded per tick. The grid is the same hashed counting sort
+// as Grid, with atomics in place of the per block histograms, so boids within a bucket (and
+// hence the order neighbours are summed in) vary from tick to tick. Needs a current GL context.
+class GpuSimulation
+{
+private:
+    // One program per pass, in dispatch order
+    unsigned m_countProgram = 0, m_scanProgram = 0, m_scatterProgram = 0, m_rulesProgram = 0,
+             m_integrateProgram = 0;
+
+    // Bucket offsets and running cursors, then per boid sorted indices, cells, cached wide
+    // neighbourhoods and steering, all with room for m_capacity boids
+    unsigned m_bucketStart = 0, m_cursor = 0, m_sorted = 0, m_cells = 0, m_wideCache = 0, m_steering = 0;
+    unsigned m_capacity = 0;
+
+    // (Re)create the scratch buffers with room for capacity boids
+    void createBuffers(const unsigned capacity);
+    void deleteBuffers();
+
+public:
+    GpuSimulation() = default;
+
+    // No copy-move ctor/assignment
+    GpuSimulation(const GpuSimulation&) = delete;
+    GpuSimulation& operator=(const GpuSimulation&) = delete;
+    GpuSimulation& operator=(GpuSimulation&&) = delete;
+    GpuSimulation(GpuSimulation&&) = delete;
+
+    ~GpuSimulation();
+
+    // Compile the passes, printing any error and returning false on failure
+    bool create();
+
+    // Advance tick.count boids held in the given position, velocity and rotation buffers by one
+    // tick. The results are visible to drawing and buffer reads issued afterwards.
+    void step(const GpuTick& tick, const unsigned positions, const unsigned velocities, const unsigned rotations);
+};
+
+#endif // GPU_SIMULATION_H
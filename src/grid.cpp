@@ -0,0 +1,118 @@
+#include "grid.h"
+
+#include <algorithm>
+
+Grid::Grid(const float cellSize, Arena* arena)
+    : m_cellSize(cellSize), m_bucketStart(ArenaAllocator<unsigned>(arena)), m_indices(ArenaAllocator<unsigned>(arena)),
+      m_cells(ArenaAllocator<glm::ivec2>(arena)), m_bucketOf(ArenaAllocator<unsigned>(arena)),
+      m_histograms(ArenaAllocator<unsigned>(arena))
+{
+}
+
+void Grid::reserve(const unsigned capacity, const unsigned workers)
+{
+    const auto buckets = bucketsFor(capacity);
+    m_bucketStart.reserve(buckets + 1);
+    m_indices.reserve(capacity);
+    m_cells.reserve(capacity);
+    m_bucketOf.reserve(capacity);
+    m_histograms.reserve(static_cast<std::size_t>(blocksFor(capacity, workers)) * buckets);
+}
+
+void Grid::build(const glm::vec2* positions, const unsigned count, Scheduler* scheduler)
+{
+    m_bucketCount = bucketsFor(count);
+
+    m_bucketStart.resize(m_bucketCount + 1);
+    m_indices.resize(count);
+    m_cells.resize(count);
+    m_bucketOf.resize(count);
+
+    // Boids are split into contiguous blocks with a histogram each, and offsets are laid out
+    // bucket major, block minor. Every bucket then lists its boids in ascending index order no
+    // matter how many blocks there are, so neighbours are visited in the same order and the
+    // simulation does not depend on the number of workers.
+    const auto workers = scheduler ? scheduler->workers() : 1u;
+    const auto blocks = blocksFor(count, workers);
+    const auto blockSize = std::max(1u, (count + blocks - 1) / blocks);
+    const auto bucketBlockSize = (m_bucketCount + blocks - 1) / blocks;
+    m_blocks.clear();
+    m_bucketBlocks.clear();
+    for (unsigned b = 0; b != blocks; ++b)
+    {
+        m_blocks.push_back({std::min(count, b * blockSize), std::min(count, (b + 1) * blockSize)});
+        m_bucketBlocks.push_back({b * bucketBlockSize, std::min(m_bucketCount, (b + 1) * bucketBlockSize)});
+    }
+    m_histograms.resize(static_cast<std::size_t>(blocks) * m_bucketCount);
+    m_bucketBlockTotals.resize(blocks);
+
+    const auto forEachBlock = [&](const std::vector<TaskRange>& ranges, auto&& f) {
+        if (scheduler)
+        {
+            scheduler->run(ranges, f);
+        }
+        else
+        {
+            f(ranges.front(), 0u);
+        }
+    };
+
+    // Histogram of boids per bucket, per block
+    forEachBlock(m_blocks, [&](const TaskRange& range, unsigned) {
+        auto* histogram = &m_histograms[static_cast<std::size_t>(range.first / blockSize) * m_bucketCount];
+        std::fill(histogram, histogram + m_bucketCount, 0u);
+        for (auto i = range.first; i != range.last; ++i)
+        {
+            m_bucketOf[i] = bucketOf(cellOf(positions[i]));
+            ++histogram[m_bucketOf[i]];
+        }
+    });
+
+    // Prefix sum into start offsets. Every block of buckets sums up its boids, those totals are
+    // scanned, then every block of buckets turns its counts into offsets from its own total.
+    const auto entry = [&](const unsigned block, const unsigned bucket) -> unsigned& {
+        return m_histograms[static_cast<std::size_t>(block) * m_bucketCount + bucket];
+    };
+    forEachBlock(m_bucketBlocks, [&](const TaskRange& range, unsigned) {
+        unsigned total = 0;
+        for (auto b = range.first; b != range.last; ++b)
+        {
+            for (unsigned block = 0; block != blocks; ++block)
+            {
+                total += entry(block, b);
+            }
+        }
+        m_bucketBlockTotals[range.first / bucketBlockSize] = total;
+    });
+    unsigned offset = 0;
+    for (auto& total : m_bucketBlockTotals)
+    {
+        offset += total;
+        total = offset - total;
+    }
+    forEachBlock(m_bucketBlocks, [&](const TaskRange& range, unsigned) {
+        auto running = m_bucketBlockTotals[range.first / bucketBlockSize];
+        for (auto b = range.first; b != range.last; ++b)
+        {
+            m_bucketStart[b] = running;
+            for (unsigned block = 0; block != blocks; ++block)
+            {
+                const auto n = entry(block, b);
+                entry(block, b) = running;
+                running += n;
+            }
+        }
+    });
+    m_bucketStart[m_bucketCount] = count;
+
+    // Scatter, using each block's offsets as its running cursor
+    forEachBlock(m_blocks, [&](const TaskRange& range, unsigned) {
+        auto* cursor = &m_histograms[static_cast<std::size_t>(range.first / blockSize) * m_bucketCount];
+        for (auto i = range.first; i != range.last; ++i)
+        {
+            const auto k = cursor[m_bucketOf[i]]++;
+            m_indices[k] = i;
+            m_cells[k] = cellOf(positions[i]);
+        }
+    });
+}
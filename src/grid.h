@@ -0,0 +1,122 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "memory.h"
+#include "scheduler.h"
+
+// Uniform spatial grid used to find boids near a point without testing the whole flock.
+// The world is unbounded, so cells are hashed into a fixed number of buckets and boids are
+// bucketed with a counting sort, leaving each bucket's members contiguous in memory.
+class Grid
+{
+private:
+    // Fewest boids worth handing to a worker of their own while building
+    static constexpr unsigned minBlockSize = 16384;
+
+    // Width and height of a single cell, should be >= the largest query radius
+    float m_cellSize;
+
+    // Number of hash buckets (always a power of two)
+    unsigned m_bucketCount = 0;
+
+    // Start offset of every bucket in m_indices, with one extra entry for the end
+    BoidArray<unsigned> m_bucketStart;
+
+    // Boid indices sorted by bucket
+    BoidArray<unsigned> m_indices;
+
+    // Cell coordinate of each entry in m_indices, used to reject hash collisions
+    BoidArray<glm::ivec2> m_cells;
+
+    // Per boid bucket, kept between builds to avoid reallocating
+    BoidArray<unsigned> m_bucketOf;
+
+    // One histogram (and later running cursor) per block of boids, m_bucketCount entries each
+    BoidArray<unsigned> m_histograms;
+
+    // Blocks of boids and of buckets handed to the workers, and the boids in each bucket block
+    std::vector<TaskRange> m_blocks, m_bucketBlocks;
+    std::vector<unsigned> m_bucketBlockTotals;
+
+    glm::ivec2 cellOf(const glm::vec2& p) const
+    {
+        return glm::ivec2(static_cast<int>(std::floor(p.x / m_cellSize)),
+                          static_cast<int>(std::floor(p.y / m_cellSize)));
+    }
+
+    // Roughly one bucket per boid, rounded up to a power of two for cheap hashing
+    static unsigned bucketsFor(const unsigned count)
+    {
+        unsigned buckets = 1;
+        while (buckets < count)
+        {
+            buckets <<= 1;
+        }
+        return buckets;
+    }
+
+    // Blocks of boids built in parallel, each with a histogram of its own
+    static unsigned blocksFor(const unsigned count, const unsigned workers)
+    {
+        return std::max(1u, std::min(workers, count / minBlockSize));
+    }
+
+    unsigned bucketOf(const glm::ivec2& c) const
+    {
+        const auto h = static_cast<std::uint32_t>(c.x) * 73856093u ^ static_cast<std::uint32_t>(c.y) * 19349663u;
+        return h & (m_bucketCount - 1);
+    }
+
+public:
+    // The large per entry arrays are allocated from arena if given
+    explicit Grid(const float cellSize, Arena* arena = nullptr);
+
+    // Change the cell size for the next build, keeping the buffers
+    void setCellSize(const float cellSize) { m_cellSize = cellSize; }
+
+    // Make room for builds of up to capacity boids on workers threads, so that they never
+    // reallocate
+    void reserve(const unsigned capacity, const unsigned workers);
+
+    // Re-bucket count positions, must be called whenever positions have moved. With a scheduler
+    // the counting sort runs on all of its workers; the result is the same either way.
+    void build(const glm::vec2* positions, const unsigned count, Scheduler* scheduler = nullptr);
+
+    // Call f(index) for every boid in the 3x3 block of cells around p. This is a superset of
+    // the boids within m_cellSize of p, so callers still do their own distance test.
+    template <typename F>
+    void forEachNear(const glm::vec2& p, F&& f) const
+    {
+        const auto centre = cellOf(p);
+        for (int dy = -1; dy <= 1; ++dy)
+        {
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                const glm::ivec2 cell(centre.x + dx, centre.y + dy);
+                const auto bucket = bucketOf(cell);
+                for (auto k = m_bucketStart[bucket]; k != m_bucketStart[bucket + 1]; ++k)
+                {
+                    if (m_cells[k] == cell)
+                    {
+                        f(m_indices[k]);
+                    }
+                }
+            }
+        }
+    }
+
+    float cellSize() const { return m_cellSize; }
+
+    // Boid indices sorted by bucket. Bucket b holds positions [bucketStart(b), bucketStart(b + 1)).
+    const BoidArray<unsigned>& sorted() const { return m_indices; }
+    unsigned bucketCount() const { return m_bucketCount; }
+    unsigned bucketStart(const unsigned b) const { return m_bucketStart[b]; }
+};
+
+#endif // GRID_H
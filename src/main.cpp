@@ -1,8 +1,22 @@
+#include "batch.h"
 #include "detail.h"
 #include "flock.h"
+#include "offscreen.h"
+#include "recorder.h"
+#include "replay.h"
+#include "shared_state.h"
+#include "slabs.h"
+#include "timing.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "gl_core4_5.hpp"
 #include "GLFW/glfw3.h"
@@ -15,6 +29,42 @@ GLFWwindow* g_window = nullptr;
 // The flock object
 Flock g_flock(888);
 
+// Records every tick of the flock when --record is given
+std::unique_ptr<TrajectoryRecorder> g_recorder;
+
+// Plays back a recorded trajectory instead of simulating when --replay is given
+std::unique_ptr<TrajectoryReader> g_replay;
+
+// Exports every tick to other processes when --share is given
+std::unique_ptr<SharedStateWriter> g_shared;
+
+// Shows the flock another process exports when --observe is given
+std::unique_ptr<SharedStateReader> g_observed;
+
+// Per phase CPU and GPU times of every frame, only kept when --timing is given
+struct RenderTimers
+{
+    PassTimer clear{"Clear"};
+    PassTimer draw{"Draw"};
+    PassTimer upload{"Upload"};
+
+    // Presenting has no meaningful GPU time of its own, only the CPU time it blocks for
+    TimingStats present;
+
+    void endFrame()
+    {
+        clear.endFrame();
+        draw.endFrame();
+        upload.endFrame();
+    }
+};
+std::unique_ptr<RenderTimers> g_timers;
+
+// Replay position in (fractional) frames, playback speed multiplier and pause state
+double g_playhead = 0.0;
+double g_playbackSpeed = 1.0;
+bool g_paused = false;
+
 #ifndef NDEBUG
 // For GL Debug
 unsigned g_unusedID = 0;
@@ -23,7 +73,15 @@ unsigned g_unusedID = 0;
 // The OpenGL Shader Program used for all drawing
 unsigned g_shaderProgram = 0;
 
-bool init()
+// Width and height of the world area the projection shows, one unit per pixel of the window
+// until zoomed
+float g_viewSize = 800.f;
+
+// Only boids in view are uploaded and drawn unless --no-cull is given
+bool g_cull = true;
+
+// Create the window and GL context, hidden unless visible is set
+bool init(const bool visible = true)
 {
     // Prepare error callback
     glfwSetErrorCallback(glfwErrorCallback);
@@ -42,6 +100,7 @@ bool init()
     glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
 #endif
     glfwWindowHint(GLFW_FLOATING, GLFW_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
     // Create Window
     g_window = glfwCreateWindow(800, 800, "Flocking GL", nullptr, nullptr);
@@ -75,6 +134,70 @@ bool init()
     return true;
 }
 
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    // S - Save a snapshot of the flock at the current tick
+    if (key == GLFW_KEY_S && action == GLFW_PRESS)
+    {
+        const auto path = "flock_" + std::to_string(g_flock.tick()) + ".snap";
+        g_flock.sync();
+        if (g_flock.saveSnapshot(path))
+        {
+            std::cout << "Saved " << path << '\n';
+        }
+    }
+
+    // Replay controls
+    // Space - Pause / Resume, Left / Right - Seek 1 second, Up / Down - Double / Halve speed
+    // Home - Restart
+    if (g_replay && (action == GLFW_PRESS || action == GLFW_REPEAT))
+    {
+        const auto lastFrame = static_cast<double>(g_replay->frameCount() - 1);
+        switch (key)
+        {
+        case GLFW_KEY_SPACE: g_paused = !g_paused; break;
+        case GLFW_KEY_LEFT: g_playhead = std::max(g_playhead - 120.0, 0.0); break;
+        case GLFW_KEY_RIGHT: g_playhead = std::min(g_playhead + 120.0, lastFrame); break;
+        case GLFW_KEY_UP: g_playbackSpeed = std::min(g_playbackSpeed * 2.0, 64.0); break;
+        case GLFW_KEY_DOWN: g_playbackSpeed = std::max(g_playbackSpeed * 0.5, 1.0 / 64.0); break;
+        case GLFW_KEY_HOME: g_playhead = 0.0; break;
+        default: break;
+        }
+    }
+}
+
+// Compile the boid shader and enable it
+void prepareShader()
+{
+    makeShader();
+    gl::UseProgram(g_shaderProgram);
+}
+
+// Show the g_viewSize wide square of world from the top left corner: set the projection, and
+// tell flock the area in view (if culling) and how large a world unit is on screen
+void setView(Flock& flock, const bool cull)
+{
+    // The program is always used, so the Uniform only changes with the view
+    const auto pmat = glm::ortho(0.f, g_viewSize, g_viewSize, 0.f);
+    auto loc = gl::GetUniformLocation(g_shaderProgram, "projectionMatrix");
+    gl::UniformMatrix4fv(loc, 1, gl::FALSE_, glm::value_ptr(pmat));
+
+    if (cull)
+    {
+        flock.setVisibleArea(glm::vec2(0.f), glm::vec2(g_viewSize));
+    }
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(g_window, &width, &height);
+    flock.setPixelsPerUnit(static_cast<float>(width) / g_viewSize);
+}
+
+// Scroll - Zoom in / out, keeping the top left corner in place
+void scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+{
+    g_viewSize = std::clamp(g_viewSize * std::pow(1.25f, static_cast<float>(-yoffset)), 100.f, 25600.f);
+    setView(g_flock, g_cull);
+}
+
 void terminate()
 {
     gl::DeleteProgram(g_shaderProgram);
@@ -82,6 +205,25 @@ void terminate()
     glfwTerminate();
 }
 
+void draw()
+{
+    {
+        TimedScope timed(g_timers ? &g_timers->clear : nullptr);
+        gl::Clear(gl::COLOR_BUFFER_BIT);  // Clear buffer
+    }
+    {
+        TimedScope timed(g_timers ? &g_timers->draw : nullptr);
+        g_flock.draw();  // Draw the Flock
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    glfwSwapBuffers(g_window);  // Swap the back/front buffer to display
+    if (g_timers)
+    {
+        g_timers->present.add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+}
+
 void update()
 {
     // Static time for last update
@@ -94,48 +236,530 @@ void update()
     constexpr auto updateDelta = std::chrono::duration<float>(1.f / 120.f);
     if ((now - lastUpdate) > updateDelta)
     {
-        g_flock.update(updateDelta.count());
+        // The boids follow the cursor, scaled from window to world coordinates
+        double x, y;
+        glfwGetCursorPos(g_window, &x, &y);
+        int width = 0, height = 0;
+        glfwGetWindowSize(g_window, &width, &height);
+        const auto scale = g_viewSize / static_cast<float>(std::max(width, 1));
+        g_flock.setTarget(glm::vec2(static_cast<float>(x), static_cast<float>(y)) * scale);
+
+        // The previous tick is drawn and presented while the other threads evaluate this one, so
+        // waiting for vsync overlaps the simulation instead of following it
+        g_flock.update(updateDelta.count(), draw);
         lastUpdate = now;
+
+        // On the GPU the boids only come back to the CPU when something needs them
+        if (g_recorder || g_shared)
+        {
+            g_flock.sync();
+        }
+        if (g_recorder)
+        {
+            g_recorder->record(g_flock.tick(), g_flock.positions().data(), g_flock.velocities().data(),
+                               g_flock.count());
+        }
+        if (g_shared)
+        {
+            g_shared->publish(g_flock.tick(), g_flock.positions().data(), g_flock.velocities().data(),
+                              g_flock.count());
+        }
+    }
+    else
+    {
+        draw();
     }
 }
 
-void draw()
+void replay()
+{
+    // Static time for last frame
+    static auto lastFrame = std::chrono::steady_clock::now();
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> elapsed = now - lastFrame;
+    lastFrame = now;
+
+    // Trajectories are recorded at the 120 Hz update rate
+    if (!g_paused)
+    {
+        g_playhead += elapsed.count() * 120.0 * g_playbackSpeed;
+        g_playhead = std::min(g_playhead, static_cast<double>(g_replay->frameCount() - 1));
+    }
+
+    // Only feed the flock when the frame actually changes
+    static std::size_t shownFrame = static_cast<std::size_t>(-1);
+    const auto frame = static_cast<std::size_t>(std::floor(g_playhead));
+    if (frame != shownFrame && g_replay->seek(frame))
+    {
+        g_flock.setFrame(g_replay->positions(), g_replay->velocities(), g_replay->count(),
+                         static_cast<unsigned>(g_replay->tick()));
+        shownFrame = frame;
+    }
+}
+
+void observe()
+{
+    // Copy the latest tick exported by the other process and only show it once the read is known
+    // not to have overlapped a write. Torn copies are thrown away and the last good tick stays up.
+    static std::vector<glm::vec2> positions, velocities;
+    std::uint64_t tick = 0;
+    const bool consistent = g_observed->read([&](const SharedStateView& view) {
+        positions.assign(view.positions, view.positions + view.count);
+        velocities.assign(view.velocities, view.velocities + view.count);
+        tick = view.tick;
+    });
+    if (consistent)
+    {
+        g_flock.setFrame(positions.data(), velocities.data(), static_cast<unsigned>(positions.size()),
+                         static_cast<unsigned>(tick));
+    }
+}
+
+// Simulate ticks on the CPU and on the GPU from the same boids and compare them after every tick,
+// restarting the GPU from the CPU's boids each time since any difference grows chaotically. Also
+// checks that culling on the GPU finds the same boids in view as culling on the CPU. Returns the
+// process exit code, failing if more than 1 in 1000 boids strays from the CPU or culling differs.
+int verifyGpu(const unsigned ticks)
+{
+    // With staggered wide rules a single differing refresh would persist, so refresh every tick
+    FlockParams params;
+    params.seed = 1;
+    params.wideRuleStride = 1;
+    Flock cpu(4096, 0, params), gpu(4096, 0, params);
+    cpu.createDrawData();
+    gpu.createDrawData();
+    if (!gpu.setGpu(true))
+    {
+        return 1;
+    }
+    cpu.setTarget(glm::vec2(400.f, 400.f));
+    gpu.setTarget(glm::vec2(400.f, 400.f));
+
+    // Cull against a quarter of the view, so there are boids on both sides of its edges. The
+    // reference flock culls the GPU's boids on the CPU.
+    prepareShader();
+    Flock reference(0, 4096);
+    reference.createDrawData();
+    const glm::vec2 area(g_viewSize / 2.f);
+    reference.setVisibleArea(glm::vec2(0.f), area);
+    gpu.setVisibleArea(glm::vec2(0.f), area);
+    if (!gpu.setGpuCulling(true))
+    {
+        return 1;
+    }
+
+    constexpr float tolerance = 0.01f;
+    float largest = 0.f;
+    unsigned strays = 0;
+    unsigned miscounted = 0;
+    for (unsigned t = 0; t != ticks; ++t)
+    {
+        gpu.setFrame(cpu.positions().data(), cpu.velocities().data(), cpu.count(), cpu.tick());
+        cpu.update(1.f / 120.f);
+        gpu.update(1.f / 120.f);
+        gpu.sync();
+        gpu.draw();
+        reference.setFrame(gpu.positions().data(), gpu.velocities().data(), gpu.count(), gpu.tick());
+        miscounted += gpu.drawCount() != reference.drawCount();
+        for (unsigned i = 0; i != cpu.count(); ++i)
+        {
+            const auto difference = std::max(glm::distance(cpu.positions()[i], gpu.positions()[i]),
+                                             glm::distance(cpu.velocities()[i], gpu.velocities()[i]));
+            largest = std::max(largest, difference);
+            strays += difference > tolerance;
+        }
+    }
+
+    const auto compared = ticks * cpu.count();
+    std::cout << "Compared " << compared << " boid ticks: largest difference " << largest << ", " << strays
+              << " off by more than " << tolerance << ", " << miscounted << " ticks culled differently\n";
+    if (strays * 1000 > compared)
+    {
+        std::cout << "The GPU backend does not match the CPU!\n";
+        return 1;
+    }
+    if (miscounted != 0)
+    {
+        std::cout << "Culling on the GPU does not match the CPU!\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Draw frames of a flock of boids into an offscreen framebuffer in a hidden window, without
+// vsync or presenting, and report how long clearing, drawing and uploading the boids took to
+// submit on the CPU and to execute on the GPU. The view spans g_viewSize, so zooming out far
+// enough draws points. Boids outside the view are culled unless cull is false, by a compute pass
+// if gpuCull is set, and gpu simulates on the GPU as well (which only culls that way). Returns
+// the process exit code.
+int renderBenchmark(const unsigned frames, const unsigned boids, const bool cull, const bool gpuCull, const bool gpu)
 {
-    gl::Clear(gl::COLOR_BUFFER_BIT);  // Clear buffer
-    g_flock.draw();                   // Draw the Flock
-    glfwSwapBuffers(g_window);        // Swap the back/front buffer to display
+    prepareShader();
+    glfwSwapInterval(0);
+
+    RenderTimers timers;
+    Flock flock(boids);
+    flock.createDrawData();
+    flock.setTarget(glm::vec2(400.f, 400.f));
+    flock.setUploadTimer(&timers.upload);
+    setView(flock, cull);
+    if (cull && (gpuCull || gpu) && !flock.setGpuCulling(true))
+    {
+        return 1;
+    }
+    if (gpu && !flock.setGpu(true))
+    {
+        return 1;
+    }
+    OffscreenTarget target(800, 800);
+    if (!target)
+    {
+        return 1;
+    }
+    target.bind();
+
+    // The first frames compile shaders and warm up caches (and the first timer query of a
+    // context can be garbage on llvmpipe), so they are drawn but not counted
+    constexpr unsigned warmUp = 10;
+    std::size_t drawn = 0;
+    for (unsigned f = 0; f != warmUp + frames; ++f)
+    {
+        if (f == warmUp)
+        {
+            timers.clear.reset();
+            timers.draw.reset();
+            timers.upload.reset();
+            drawn = 0;
+        }
+
+        flock.update(1.f / 120.f);
+        {
+            TimedScope timed(&timers.clear);
+            gl::Clear(gl::COLOR_BUFFER_BIT);
+        }
+        {
+            TimedScope timed(&timers.draw);
+            flock.draw();
+        }
+        timers.endFrame();
+
+        // Outside the timed passes, since culling on the GPU makes this wait for the frame
+        drawn += flock.drawCount();
+    }
+    timers.clear.finish();
+    timers.draw.finish();
+    timers.upload.finish();
+
+    std::cout << "Rendered " << frames << " frames of " << boids << " boids offscreen on " << gl::GetString(gl::RENDERER)
+              << ", " << static_cast<double>(drawn) / frames << " drawn per frame on average\n";
+    timers.clear.print();
+    timers.draw.print();
+    timers.upload.print();
+
+    // An empty frame means nothing was drawn, e.g. because the shader failed
+    return target.checksum() != 0 ? 0 : 1;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    // --batch <spec> [--out <file>] runs a headless parameter sweep and exits
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            const std::string specPath = argv[i + 1];
+            std::string outPath = "batch.csv";
+            for (int j = 1; j + 1 < argc; ++j)
+            {
+                if (std::strcmp(argv[j], "--out") == 0)
+                {
+                    outPath = argv[j + 1];
+                }
+            }
+            return runBatch(specPath, outPath);
+        }
+    }
+
+    // --slabs <n> [--boids <count>] [--ticks <ticks>] [--rebalance <ticks>] runs a headless simulation split
+    // over n processes, moving the slab borders every --rebalance ticks (0 keeps them fixed)
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--slabs") == 0 && i + 1 < argc)
+        {
+            const auto processes = static_cast<unsigned>(std::stoul(argv[i + 1]));
+            unsigned boids = 10000, ticks = 1200, rebalance = 60;
+            for (int j = 1; j + 1 < argc; ++j)
+            {
+                if (std::strcmp(argv[j], "--boids") == 0)
+                {
+                    boids = static_cast<unsigned>(std::stoul(argv[j + 1]));
+                }
+                else if (std::strcmp(argv[j], "--ticks") == 0)
+                {
+                    ticks = static_cast<unsigned>(std::stoul(argv[j + 1]));
+                }
+                else if (std::strcmp(argv[j], "--rebalance") == 0)
+                {
+                    rebalance = static_cast<unsigned>(std::stoul(argv[j + 1]));
+                }
+            }
+            return runSlabs(processes, boids, ticks, rebalance);
+        }
+    }
+
+    // --verify-gpu <ticks> checks the GPU backend against the CPU in a hidden window and exits
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--verify-gpu") == 0)
+        {
+            if (!init(false))
+            {
+                return 1;
+            }
+            const auto result = verifyGpu(static_cast<unsigned>(std::stoul(argv[i + 1])));
+            terminate();
+            return result;
+        }
+    }
+
+    // --render-bench <frames> [--boids <count>] [--view <size>] [--no-cull] [--gpu-cull] [--gpu] measures
+    // drawing in a hidden window and exits
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--render-bench") == 0)
+        {
+            unsigned boids = 10000;
+            bool cull = true, gpuCull = false, gpu = false;
+            for (int j = 1; j < argc; ++j)
+            {
+                if (std::strcmp(argv[j], "--boids") == 0 && j + 1 < argc)
+                {
+                    boids = static_cast<unsigned>(std::stoul(argv[j + 1]));
+                }
+                else if (std::strcmp(argv[j], "--view") == 0 && j + 1 < argc)
+                {
+                    g_viewSize = std::stof(argv[j + 1]);
+                }
+                else if (std::strcmp(argv[j], "--no-cull") == 0)
+                {
+                    cull = false;
+                }
+                else if (std::strcmp(argv[j], "--gpu-cull") == 0)
+                {
+                    gpuCull = true;
+                }
+                else if (std::strcmp(argv[j], "--gpu") == 0)
+                {
+                    gpu = true;
+                }
+            }
+            if (!init(false))
+            {
+                return 1;
+            }
+            const auto result = renderBenchmark(static_cast<unsigned>(std::stoul(argv[i + 1])), boids, cull, gpuCull, gpu);
+            terminate();
+            return result;
+        }
+    }
+
+    // --load <file> resumes from a snapshot instead of random initial conditions
+    // --record <file> records a trajectory, --compress stores it compressed
+    // --replay <file> plays back a recorded trajectory instead of simulating
+    // --share <name> exports every tick to shared memory, --observe <name> shows such an export
+    // --threads <n> simulates on n threads instead of one per core, --pin binds them to cores
+    // --fixed simulates in fixed point, bit-identical on every machine
+    // --gpu simulates with compute shaders on the GPU
+    // --timing measures every clear, draw, upload and present and prints their statistics on exit
+    // --no-cull uploads and draws every boid, not just the ones in view
+    // --gpu-cull culls with a compute pass instead of on the CPU, as --gpu always does
+    // --view <size> starts with a view of size world units across instead of 800 (scrolling zooms)
+    std::string recordPath;
+    auto recordFormat = TrajectoryRecorder::Format::Raw;
+    auto threads = std::max(std::thread::hardware_concurrency(), 1u);
+    bool pin = false;
+    bool gpu = false;
+    bool gpuCull = false;
+    bool fixed = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+        {
+            if (!g_flock.loadSnapshot(argv[++i]))
+            {
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            recordPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--compress") == 0)
+        {
+            recordFormat = TrajectoryRecorder::Format::Compressed;
+        }
+        else if (std::strcmp(argv[i], "--share") == 0 && i + 1 < argc)
+        {
+            g_shared = std::make_unique<SharedStateWriter>(argv[++i], 2 * g_flock.capacity());
+            if (!*g_shared)
+            {
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--observe") == 0 && i + 1 < argc)
+        {
+            g_observed = std::make_unique<SharedStateReader>(argv[++i]);
+            if (!*g_observed)
+            {
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--pin") == 0)
+        {
+            pin = true;
+        }
+        else if (std::strcmp(argv[i], "--fixed") == 0)
+        {
+            fixed = true;
+        }
+        else if (std::strcmp(argv[i], "--gpu") == 0)
+        {
+            gpu = true;
+        }
+        else if (std::strcmp(argv[i], "--no-cull") == 0)
+        {
+            g_cull = false;
+        }
+        else if (std::strcmp(argv[i], "--view") == 0 && i + 1 < argc)
+        {
+            g_viewSize = std::stof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--gpu-cull") == 0)
+        {
+            gpuCull = true;
+        }
+        else if (std::strcmp(argv[i], "--timing") == 0)
+        {
+            g_timers = std::make_unique<RenderTimers>();
+            g_flock.setUploadTimer(&g_timers->upload);
+        }
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            g_replay = std::make_unique<TrajectoryReader>(argv[++i]);
+            if (!*g_replay)
+            {
+                return 1;
+            }
+        }
+    }
+
+    // After --load, which resumes in the snapshot's mode, so a float snapshot is converted but
+    // a fixed point one continues bit for bit
+    if (fixed)
+    {
+        g_flock.setFixedPoint(true);
+    }
+
+    // After --load, so the loaded boids are the ones placed across the workers' memory
+    g_flock.setThreads(threads, pin);
+
+    // Report how much memory the flock holds and what backs it, for sizing hosts
+    const auto storage = g_flock.footprint();
+    const char* pages[] = {"huge pages", "transparent huge pages", "normal pages"};
+    std::cout << "Boid storage: " << storage.reserved / 1048576.0 << " MB reserved in "
+              << pages[static_cast<int>(storage.pages)] << ", " << storage.used / 1048576.0 << " MB used\n";
+
+    if (!recordPath.empty())
+    {
+        g_recorder = std::make_unique<TrajectoryRecorder>(recordPath, g_flock.capacity(), 8,
+                                                          TrajectoryRecorder::Policy::Drop, recordFormat);
+        if (!*g_recorder)
+        {
+            return 1;
+        }
+    }
+
     // Init GLFW/OpenGL or exit on fail
     if (!init())
     {
         return 1;
     }
+    glfwSetKeyCallback(g_window, keyCallback);
+    glfwSetScrollCallback(g_window, scrollCallback);
 
     // Prepare the shader and enable it
-    makeShader();
-    gl::UseProgram(g_shaderProgram);
-
-    // Set the projection Uniform once, since program is always used
-    const auto pmat = glm::ortho(0.f, 400.f, 400.f, 0.f);
-    auto loc = gl::GetUniformLocation(g_shaderProgram, "projectionMatrix");
-    gl::UniformMatrix4fv(loc, 1, gl::FALSE_, glm::value_ptr(pmat));
+    prepareShader();
 
     // Create vertices / draw data for the Flock once
     g_flock.createDrawData();
+    setView(g_flock, g_cull);
+    if (g_cull && (gpuCull || gpu) && !g_flock.setGpuCulling(true))
+    {
+        return 1;
+    }
+    if (gpu && !g_flock.setGpu(true))
+    {
+        return 1;
+    }
 
     // Then loop until window should close
     while (!glfwWindowShouldClose(g_window))
     {
         glfwPollEvents();
-        update();
-        draw();
+        if (g_replay)
+        {
+            replay();
+            draw();
+        }
+        else if (g_observed)
+        {
+            observe();
+            draw();
+        }
+        else
+        {
+            update();
+        }
+        if (g_timers)
+        {
+            g_timers->endFrame();
+        }
+    }
+
+    std::cout << "Tick scratch high-water: " << g_flock.scratchHighWater() / 1024.0 << " KB per thread\n";
+
+    // The queries belong to the GL context, so they go before it does
+    if (g_timers)
+    {
+        g_timers->clear.finish();
+        g_timers->draw.finish();
+        g_timers->upload.finish();
+        g_timers->clear.print();
+        g_timers->draw.print();
+        g_timers->upload.print();
+        g_timers->present.print("Present CPU");
+        g_flock.setUploadTimer(nullptr);
+        g_timers.reset();
+    }
+
+    // Finish writing the trajectory before tearing down
+    int code = 0;
+    if (g_recorder)
+    {
+        if (!g_recorder->finish())
+        {
+            code = 1;
+        }
+        std::cout << "Dropped " << g_recorder->dropped() << " ticks while recording\n";
+        g_recorder.reset();
     }
 
     // Do some cleanup of GL / GLFW resources
     terminate();
 
-    return 0;
+    return code;
 }
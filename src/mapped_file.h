@@ -0,0 +1,32 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. The mapping is released on destruction.
+class MappedFile
+{
+private:
+    // Start of the mapping, nullptr if the file could not be mapped
+    const unsigned char* m_data = nullptr;
+
+    // Size of the file in bytes
+    std::size_t m_size = 0;
+
+public:
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    // True if the file was mapped successfully
+    explicit operator bool() const { return m_data != nullptr; }
+
+    const unsigned char* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+};
+
+#endif // MAPPED_FILE_H
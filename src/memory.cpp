@@ -0,0 +1,126 @@
+#include "memory.h"
+
+#include <cstdint>
+
+#include <sys/mman.h>
+
+Arena::Arena(const std::size_t bytes)
+{
+    m_size = (bytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+    if (m_size == 0)
+    {
+        return;
+    }
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages only exist if the administrator reserved them (vm.nr_hugepages), and
+    // mapping fails cleanly when there are not enough
+    void* huge = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (huge != MAP_FAILED)
+    {
+        m_base = static_cast<unsigned char*>(huge);
+        m_mapped = m_size;
+        m_pages = Pages::Huge;
+        return;
+    }
+#endif
+
+    // Map one huge page extra so the region can start on a huge page boundary, which transparent
+    // huge pages need, then give the unused ends back
+    const auto mapped = m_size + hugePageSize;
+    void* normal = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (normal == MAP_FAILED)
+    {
+        // Everything goes to the heap
+        m_size = 0;
+        return;
+    }
+    auto* start = static_cast<unsigned char*>(normal);
+    const auto address = reinterpret_cast<std::uintptr_t>(start);
+    auto* aligned = start + ((hugePageSize - address % hugePageSize) % hugePageSize);
+    if (aligned != start)
+    {
+        munmap(start, static_cast<std::size_t>(aligned - start));
+    }
+    const auto tail = static_cast<std::size_t>(start + mapped - (aligned + m_size));
+    if (tail != 0)
+    {
+        munmap(aligned + m_size, tail);
+    }
+    m_base = aligned;
+    m_mapped = m_size;
+
+#ifdef MADV_HUGEPAGE
+    m_pages = madvise(m_base, m_size, MADV_HUGEPAGE) == 0 ? Pages::Transparent : Pages::Normal;
+#endif
+}
+
+Arena::~Arena()
+{
+    if (m_base)
+    {
+        munmap(m_base, m_mapped);
+    }
+}
+
+void* Arena::allocate(const std::size_t bytes)
+{
+    const auto offset = (m_used + alignment - 1) / alignment * alignment;
+    if (m_base && offset + bytes <= m_size)
+    {
+        m_used = offset + bytes;
+        return m_base + offset;
+    }
+
+    m_heap += bytes;
+    return ::operator new(bytes, std::align_val_t(alignment));
+}
+
+TickArena::TickArena()
+{
+    reset();
+}
+
+void* TickArena::do_allocate(const std::size_t bytes, const std::size_t alignment)
+{
+    // Counting the worst case padding keeps the next buffer large enough
+    m_used += bytes + alignment - 1;
+    return m_resource->allocate(bytes, alignment);
+}
+
+void TickArena::reset()
+{
+    m_highWater = std::max(m_highWater, m_used);
+    m_used = 0;
+
+    // Dropping the resource returns whatever overflowed to the heap
+    m_resource.reset();
+    if (m_highWater > m_capacity)
+    {
+        constexpr std::size_t page = 4096;
+        m_capacity = (m_highWater + page - 1) / page * page;
+        m_buffer.reset(new std::byte[m_capacity]);
+    }
+
+    if (m_capacity != 0)
+    {
+        m_resource.emplace(m_buffer.get(), m_capacity, std::pmr::new_delete_resource());
+    }
+    else
+    {
+        m_resource.emplace(std::pmr::new_delete_resource());
+    }
+}
+
+void Arena::deallocate(void* p, const std::size_t bytes)
+{
+    // Memory in the region is only reclaimed with the whole arena
+    auto* q = static_cast<unsigned char*>(p);
+    if (m_base && q >= m_base && q < m_base + m_size)
+    {
+        return;
+    }
+
+    m_heap -= bytes;
+    ::operator delete(p, std::align_val_t(alignment));
+}
@@ -0,0 +1,173 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// One contiguous region holding the long-lived arrays of a flock. It is backed by 2 MB huge pages
+// where the system has them reserved, otherwise by normal pages with transparent huge pages
+// requested. Every allocation is 64-byte aligned. Allocation bumps a pointer and memory is only
+// returned when the arena is destroyed, so arrays are sized once up front. Requests that do not
+// fit fall back to the heap, still aligned. Not thread safe, allocate from one thread.
+class Arena
+{
+public:
+    static constexpr std::size_t alignment = 64;
+    static constexpr std::size_t hugePageSize = std::size_t(2) << 20;
+
+    // What backs the region
+    enum class Pages
+    {
+        Huge,        // Explicit huge pages (MAP_HUGETLB)
+        Transparent, // Normal pages with transparent huge pages requested
+        Normal,      // Normal pages
+    };
+
+    // Sizes in bytes
+    struct Footprint
+    {
+        std::size_t reserved = 0; // Size of the region
+        std::size_t used = 0;     // Handed out from the region, including alignment
+        std::size_t heap = 0;     // Currently allocated from the heap because the region was full
+        Pages pages = Pages::Normal;
+    };
+
+private:
+    unsigned char* m_base = nullptr;
+    std::size_t m_size = 0;
+    std::size_t m_mapped = 0;
+    std::size_t m_used = 0;
+    std::size_t m_heap = 0;
+    Pages m_pages = Pages::Normal;
+
+public:
+    // Reserve at least bytes, rounded up to whole huge pages
+    explicit Arena(const std::size_t bytes);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena();
+
+    void* allocate(const std::size_t bytes);
+    void deallocate(void* p, const std::size_t bytes);
+
+    Footprint footprint() const { return {m_size, m_used, m_heap, m_pages}; }
+};
+
+// Allocator drawing from an arena, or from the (aligned) heap without one. Elements are
+// default-initialized rather than value-initialized, so growing a container of trivial types
+// leaves the new elements and their pages untouched. Whichever thread writes them first then
+// decides which NUMA node the pages end up on.
+template <typename T>
+class ArenaAllocator
+{
+private:
+    template <typename U>
+    friend class ArenaAllocator;
+
+    Arena* m_arena = nullptr;
+
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    ArenaAllocator() = default;
+    explicit ArenaAllocator(Arena* arena) noexcept : m_arena(arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : m_arena(other.m_arena)
+    {
+    }
+
+    T* allocate(const std::size_t n)
+    {
+        if (m_arena)
+        {
+            return static_cast<T*>(m_arena->allocate(n * sizeof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Arena::alignment)));
+    }
+
+    void deallocate(T* p, const std::size_t n)
+    {
+        if (m_arena)
+        {
+            m_arena->deallocate(p, n * sizeof(T));
+        }
+        else
+        {
+            ::operator delete(p, std::align_val_t(Arena::alignment));
+        }
+    }
+
+    template <typename U>
+    void construct(U* p)
+    {
+        ::new (static_cast<void*>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const
+    {
+        return m_arena == other.m_arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const
+    {
+        return m_arena != other.m_arena;
+    }
+};
+
+// Storage for one per boid (or per grid entry) attribute
+template <typename T>
+using BoidArray = std::vector<T, ArenaAllocator<T>>;
+
+// Memory for the temporaries of one tick on one thread. Allocation bumps through a buffer,
+// freeing is a no-op and reset() drops everything at once. The buffer grows to the high-water
+// mark of earlier ticks, so once that has settled a tick never touches the heap or contends
+// with other threads for it. Containers using it must be emptied before reset().
+class TickArena : public std::pmr::memory_resource
+{
+private:
+    std::unique_ptr<std::byte[]> m_buffer;
+    std::size_t m_capacity = 0;
+    std::size_t m_used = 0;
+    std::size_t m_highWater = 0;
+    std::optional<std::pmr::monotonic_buffer_resource> m_resource;
+
+    void* do_allocate(const std::size_t bytes, const std::size_t alignment) override;
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+    TickArena();
+
+    TickArena(const TickArena&) = delete;
+    TickArena& operator=(const TickArena&) = delete;
+
+    // Release everything allocated since the last reset
+    void reset();
+
+    // Most bytes a single tick has allocated so far
+    std::size_t highWater() const { return std::max(m_highWater, m_used); }
+};
+
+#endif // MEMORY_H
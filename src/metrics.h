@@ -0,0 +1,89 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <numeric>
+#include <vector>
+
+// Flock quality metrics that Flock::update can accumulate while it already visits every boid
+// and its neighbours. Each metric has its own flag, and the update kernel is instantiated per
+// combination of flags, so disabled metrics are compiled out rather than branched over.
+enum MetricFlags : unsigned
+{
+    MetricNone = 0,
+    MetricOrder = 1 << 0,           // Mean normalized velocity
+    MetricClusters = 1 << 1,        // Number of connected groups of boids
+    MetricNearestNeighbour = 1 << 2, // Mean distance to the nearest other boid
+    MetricCollisions = 1 << 3,      // Pairs of boids closer than collisionDistance
+    MetricAll = (1 << 4) - 1,
+};
+
+// Boids whose centres are closer than this are considered to collide
+constexpr float collisionDistance = 2.f;
+
+struct FlockMetrics
+{
+    // Length of the mean normalized velocity, 1 when every boid heads the same way
+    float orderParameter = 0.f;
+
+    // Connected components of the graph linking boids within the neighbour distance. Gathered
+    // from the staggered wide rule pass, so it is refreshed once per full round of boids.
+    unsigned clusterCount = 0;
+
+    // Mean distance to the nearest other boid, over boids that have one within the neighbour
+    // distance. Uses the narrow pass every tick and the last wide pass for sparser boids.
+    float meanNearestNeighbour = 0.f;
+
+    // Pairs of boids closer than collisionDistance this tick
+    unsigned collisions = 0;
+};
+
+// Union-find over boid indices, used to count clusters
+class DisjointSets
+{
+private:
+    std::vector<unsigned> m_parent;
+
+public:
+    // Put each of count elements into its own set
+    void reset(const unsigned count)
+    {
+        m_parent.resize(count);
+        std::iota(m_parent.begin(), m_parent.end(), 0u);
+    }
+
+    unsigned size() const { return static_cast<unsigned>(m_parent.size()); }
+
+    unsigned find(unsigned i)
+    {
+        // Path halving
+        while (m_parent[i] != i)
+        {
+            m_parent[i] = m_parent[m_parent[i]];
+            i = m_parent[i];
+        }
+        return i;
+    }
+
+    void unite(const unsigned a, const unsigned b)
+    {
+        const auto ra = find(a);
+        const auto rb = find(b);
+        if (ra != rb)
+        {
+            m_parent[ra < rb ? rb : ra] = ra < rb ? ra : rb;
+        }
+    }
+
+    // Number of distinct sets
+    unsigned count() const
+    {
+        unsigned roots = 0;
+        for (unsigned i = 0; i != m_parent.size(); ++i)
+        {
+            roots += m_parent[i] == i;
+        }
+        return roots;
+    }
+};
+
+#endif // METRICS_H
@@ -0,0 +1,51 @@
+#include "offscreen.h"
+
+#include <iostream>
+#include <vector>
+
+#include "gl_core4_5.hpp"
+
+OffscreenTarget::OffscreenTarget(const int width, const int height) : m_width(width), m_height(height)
+{
+    gl::CreateRenderbuffers(1, &m_colour);
+    gl::NamedRenderbufferStorage(m_colour, gl::RGBA8, width, height);
+    gl::CreateFramebuffers(1, &m_framebuffer);
+    gl::NamedFramebufferRenderbuffer(m_framebuffer, gl::COLOR_ATTACHMENT0, gl::RENDERBUFFER, m_colour);
+
+    if (gl::CheckNamedFramebufferStatus(m_framebuffer, gl::DRAW_FRAMEBUFFER) != gl::FRAMEBUFFER_COMPLETE)
+    {
+        std::cout << "Offscreen framebuffer is incomplete!\n";
+        gl::DeleteFramebuffers(1, &m_framebuffer);
+        m_framebuffer = 0;
+    }
+}
+
+OffscreenTarget::~OffscreenTarget()
+{
+    if (m_framebuffer != 0)
+    {
+        gl::DeleteFramebuffers(1, &m_framebuffer);
+    }
+    gl::DeleteRenderbuffers(1, &m_colour);
+}
+
+void OffscreenTarget::bind() const
+{
+    gl::BindFramebuffer(gl::FRAMEBUFFER, m_framebuffer);
+    gl::Viewport(0, 0, m_width, m_height);
+}
+
+unsigned long long OffscreenTarget::checksum() const
+{
+    std::vector<unsigned char> pixels(static_cast<std::size_t>(m_width) * m_height * 4);
+    gl::NamedFramebufferReadBuffer(m_framebuffer, gl::COLOR_ATTACHMENT0);
+    gl::BindFramebuffer(gl::READ_FRAMEBUFFER, m_framebuffer);
+    gl::ReadPixels(0, 0, m_width, m_height, gl::RGBA, gl::UNSIGNED_BYTE, pixels.data());
+
+    unsigned long long sum = 0;
+    for (const auto byte : pixels)
+    {
+        sum += byte;
+    }
+    return sum;
+}
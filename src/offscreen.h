@@ -0,0 +1,33 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+// A framebuffer object with a colour renderbuffer, for drawing without presenting anything
+// (e.g. in a hidden window under a software rasterizer). Needs a current GL context.
+class OffscreenTarget
+{
+private:
+    // Framebuffer and its colour attachment, 0 if creation failed
+    unsigned m_framebuffer = 0;
+    unsigned m_colour = 0;
+
+    int m_width, m_height;
+
+public:
+    OffscreenTarget(const int width, const int height);
+
+    OffscreenTarget(const OffscreenTarget&) = delete;
+    OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+    ~OffscreenTarget();
+
+    // True if the framebuffer is complete
+    explicit operator bool() const { return m_framebuffer != 0; }
+
+    // Draw into this target from now on, over its whole area
+    void bind() const;
+
+    // Sum of all bytes of the colour buffer, a cheap check that something was drawn
+    unsigned long long checksum() const;
+};
+
+#endif // OFFSCREEN_H
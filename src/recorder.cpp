@@ -0,0 +1,172 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "trajectory.h"
+
+TrajectoryRecorder::TrajectoryRecorder(const std::string& path, const unsigned boidCapacity,
+                                       const unsigned frameCount, const Policy policy, const Format format)
+    : m_frames(std::max(frameCount, 1u)), m_policy(policy), m_format(format), m_path(path),
+      m_file(path, std::ios::binary | std::ios::trunc)
+{
+    if (!m_file)
+    {
+        std::cout << "Failed to open trajectory " << path << " for writing!\n";
+        return;
+    }
+
+    TrajectoryHeader header{};
+    std::memcpy(header.magic, trajectoryMagic, sizeof(header.magic));
+    header.version = trajectoryVersion;
+    header.headerSize = sizeof(TrajectoryHeader);
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Allocate all frames up front so recording only ever copies
+    for (auto& frame : m_frames)
+    {
+        frame.positions.resize(boidCapacity);
+        frame.velocities.resize(boidCapacity);
+        m_free.push_back(&frame);
+    }
+
+    m_writer = std::thread(&TrajectoryRecorder::writeLoop, this);
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    finish();
+}
+
+bool TrajectoryRecorder::finish()
+{
+    if (!m_writer.joinable())
+    {
+        return m_file && !m_failed;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_framePending.notify_one();
+    m_writer.join();
+
+    if (m_failed)
+    {
+        std::cout << "Failed to write trajectory " << m_path << "!\n";
+        return false;
+    }
+    return true;
+}
+
+bool TrajectoryRecorder::record(const std::uint64_t tick, const glm::vec2* positions, const glm::vec2* velocities,
+                                const unsigned count)
+{
+    if (!m_writer.joinable())
+    {
+        return false;
+    }
+
+    // Take a free frame, or apply the policy if there is none
+    Frame* frame = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_free.empty())
+        {
+            if (m_policy == Policy::Drop)
+            {
+                ++m_dropped;
+                return false;
+            }
+            m_frameFreed.wait(lock, [this] { return !m_free.empty(); });
+        }
+        frame = m_free.back();
+        m_free.pop_back();
+    }
+
+    // The copy happens outside the lock, the writer never touches a frame it has not been given
+    if (frame->positions.size() < count)
+    {
+        frame->positions.resize(count);
+        frame->velocities.resize(count);
+    }
+    frame->tick = tick;
+    frame->count = count;
+    std::memcpy(frame->positions.data(), positions, sizeof(glm::vec2) * count);
+    std::memcpy(frame->velocities.data(), velocities, sizeof(glm::vec2) * count);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(frame);
+    }
+    m_framePending.notify_one();
+    return true;
+}
+
+void TrajectoryRecorder::writeLoop()
+{
+    for (;;)
+    {
+        Frame* frame = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_framePending.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+
+            // Only stop once everything queued has been written
+            if (m_pending.empty())
+            {
+                break;
+            }
+            frame = m_pending.front();
+            m_pending.pop_front();
+        }
+
+        // After a failed write the file is cut short anyway, frames are only handed back
+        if (!m_failed)
+        {
+            writeFrame(*frame);
+            m_failed = !m_file;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free.push_back(frame);
+        }
+        m_frameFreed.notify_one();
+    }
+
+    if (!m_failed)
+    {
+        m_file.flush();
+        m_failed = !m_file;
+    }
+}
+
+void TrajectoryRecorder::writeFrame(const Frame& frame)
+{
+    ChunkHeader chunk{};
+    chunk.count = frame.count;
+    chunk.tick = frame.tick;
+    if (m_format == Format::Compressed)
+    {
+        // Encoding fans out over all cores, but still happens off the simulation thread
+        m_encoder.encode(frame.positions.data(), frame.velocities.data(), frame.count, m_payload);
+        chunk.type = ChunkType::Compressed;
+        chunk.payloadSize = m_payload.size();
+        m_file.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+        m_file.write(reinterpret_cast<const char*>(m_payload.data()),
+                     static_cast<std::streamsize>(m_payload.size()));
+    }
+    else
+    {
+        chunk.type = ChunkType::Raw;
+        chunk.payloadSize = 2 * sizeof(glm::vec2) * frame.count;
+        m_file.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+        m_file.write(reinterpret_cast<const char*>(frame.positions.data()),
+                     static_cast<std::streamsize>(sizeof(glm::vec2) * frame.count));
+        m_file.write(reinterpret_cast<const char*>(frame.velocities.data()),
+                     static_cast<std::streamsize>(sizeof(glm::vec2) * frame.count));
+    }
+}
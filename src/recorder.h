@@ -0,0 +1,109 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "codec.h"
+#include "glm/glm.hpp"
+
+// Records a trajectory file (see trajectory.h) without doing any I/O on the simulation thread.
+// Each recorded tick is copied into one of a fixed pool of preallocated frames and queued for
+// a background thread, which writes it out and returns the frame to the pool.
+class TrajectoryRecorder
+{
+public:
+    // What record() does when every frame in the pool is still waiting to be written
+    enum class Policy
+    {
+        Drop,  // Skip the tick and count it in dropped()
+        Block, // Wait for the writer to free a frame
+    };
+
+    // How ticks are stored in the file
+    enum class Format
+    {
+        Raw,        // Plain float arrays
+        Compressed, // Quantized deltas with periodic keyframes (see codec.h)
+    };
+
+private:
+    // A single recorded tick
+    struct Frame
+    {
+        std::uint64_t tick = 0;
+        unsigned count = 0;
+        std::vector<glm::vec2> positions;
+        std::vector<glm::vec2> velocities;
+    };
+
+    // Frame storage, never resized after construction so pointers into it stay valid
+    std::vector<Frame> m_frames;
+
+    // Frames available for recording, and frames waiting to be written (oldest first)
+    std::vector<Frame*> m_free;
+    std::deque<Frame*> m_pending;
+
+    // Protects m_free, m_pending and m_stop
+    std::mutex m_mutex;
+    std::condition_variable m_frameFreed;
+    std::condition_variable m_framePending;
+
+    Policy m_policy;
+    Format m_format;
+    bool m_stop = false;
+
+    // Compressed encoding state and output, only touched by the writer thread
+    TrajectoryEncoder m_encoder;
+    std::vector<unsigned char> m_payload;
+
+    // Number of ticks skipped because the pool was exhausted
+    std::uint64_t m_dropped = 0;
+
+    std::string m_path;
+    std::ofstream m_file;
+    std::thread m_writer;
+
+    // Set by the writer thread once a write or flush fails, after which it only returns frames
+    std::atomic<bool> m_failed{false};
+
+    // Body of the writer thread
+    void writeLoop();
+
+    // Append one frame to the file as a chunk
+    void writeFrame(const Frame& frame);
+
+public:
+    // Frames are preallocated for boidCapacity boids. More may be recorded, but then the
+    // frame has to grow on the simulation thread.
+    TrajectoryRecorder(const std::string& path, const unsigned boidCapacity, const unsigned frameCount = 8,
+                       const Policy policy = Policy::Drop, const Format format = Format::Raw);
+
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    // Writes every queued frame before returning, see finish()
+    ~TrajectoryRecorder();
+
+    // True if the file was opened successfully
+    explicit operator bool() const { return static_cast<bool>(m_file); }
+
+    // Queue one tick for writing. Returns false if it was dropped.
+    bool record(const std::uint64_t tick, const glm::vec2* positions, const glm::vec2* velocities,
+                const unsigned count);
+
+    std::uint64_t dropped() const { return m_dropped; }
+
+    // Write every queued frame and stop the writer thread. Prints the problem and returns false
+    // if the file could not be written in full. Nothing is recorded afterwards.
+    bool finish();
+};
+
+#endif // RECORDER_H
@@ -0,0 +1,130 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+TrajectoryReader::TrajectoryReader(const std::string& path) : m_file(path)
+{
+    if (!m_file)
+    {
+        std::cout << "Failed to map trajectory " << path << "!\n";
+        return;
+    }
+
+    TrajectoryHeader header;
+    if (m_file.size() < sizeof(header))
+    {
+        std::cout << path << " is not a trajectory!\n";
+        return;
+    }
+    std::memcpy(&header, m_file.data(), sizeof(header));
+    if (std::memcmp(header.magic, trajectoryMagic, sizeof(header.magic)) != 0 ||
+        header.version != trajectoryVersion || header.headerSize != sizeof(TrajectoryHeader))
+    {
+        std::cout << path << " is not a supported trajectory!\n";
+        return;
+    }
+
+    // Index every complete chunk, a trailing partial chunk (e.g. from a crash) is ignored
+    std::size_t offset = sizeof(header);
+    while (m_file.size() - offset >= sizeof(ChunkHeader))
+    {
+        ChunkHeader chunk;
+        std::memcpy(&chunk, m_file.data() + offset, sizeof(chunk));
+        offset += sizeof(chunk);
+        if (chunk.payloadSize > m_file.size() - offset)
+        {
+            break;
+        }
+
+        const auto* payload = m_file.data() + offset;
+        if (chunk.type == ChunkType::Raw && chunk.payloadSize != 2 * sizeof(glm::vec2) * chunk.count)
+        {
+            break;
+        }
+        if (chunk.type != ChunkType::Raw && chunk.type != ChunkType::Compressed)
+        {
+            break;
+        }
+
+        const bool keyframe = chunk.type == ChunkType::Raw || isKeyframe(payload, chunk.payloadSize);
+        if (keyframe)
+        {
+            m_keyframes.push_back(m_chunks.size());
+        }
+        m_chunks.push_back({payload, chunk.payloadSize, chunk.type, chunk.count, chunk.tick, keyframe});
+        offset += chunk.payloadSize;
+    }
+
+    m_current = m_chunks.size();
+    if (m_chunks.empty() || m_keyframes.empty() || m_keyframes.front() != 0)
+    {
+        std::cout << "Trajectory " << path << " has no readable ticks!\n";
+        m_chunks.clear();
+        return;
+    }
+    seek(0);
+}
+
+bool TrajectoryReader::decode(const std::size_t index)
+{
+    const auto& chunk = m_chunks[index];
+    if (chunk.type == ChunkType::Raw)
+    {
+        // Raw ticks are used in place, with no copy at all
+        m_currentPositions = reinterpret_cast<const glm::vec2*>(chunk.payload);
+        m_currentVelocities = m_currentPositions + chunk.count;
+        m_decoder.reset();
+    }
+    else
+    {
+        m_positions.resize(chunk.count);
+        m_velocities.resize(chunk.count);
+        if (!m_decoder.decode(chunk.payload, chunk.payloadSize, chunk.count, m_positions.data(),
+                              m_velocities.data()))
+        {
+            std::cout << "Failed to decode tick " << chunk.tick << "!\n";
+            m_current = m_chunks.size();
+            return false;
+        }
+        m_currentPositions = m_positions.data();
+        m_currentVelocities = m_velocities.data();
+    }
+    m_current = index;
+    return true;
+}
+
+bool TrajectoryReader::seek(const std::size_t frame)
+{
+    if (frame >= m_chunks.size())
+    {
+        return false;
+    }
+    if (frame == m_current)
+    {
+        return true;
+    }
+
+    // Playing forward only needs the next delta, anything else restarts from a keyframe
+    std::size_t first = frame;
+    if (!m_chunks[frame].keyframe && !(m_current < m_chunks.size() && m_current + 1 == frame))
+    {
+        first = *(std::upper_bound(m_keyframes.begin(), m_keyframes.end(), frame) - 1);
+
+        // Continuing from the current frame is cheaper if it lies between the keyframe and frame
+        if (m_current < m_chunks.size() && m_current > first && m_current < frame)
+        {
+            first = m_current + 1;
+        }
+    }
+
+    for (auto index = first; index <= frame; ++index)
+    {
+        if (!decode(index))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "codec.h"
+#include "glm/glm.hpp"
+#include "mapped_file.h"
+#include "trajectory.h"
+
+// Random access to the ticks of a memory mapped trajectory file (see trajectory.h).
+// Opening only walks the chunk headers to build an index, raw ticks are then read straight
+// out of the mapping and compressed ticks are decoded from the nearest keyframe.
+class TrajectoryReader
+{
+private:
+    // Location of one tick in the file
+    struct Chunk
+    {
+        const unsigned char* payload;
+        std::size_t payloadSize;
+        ChunkType type;
+        unsigned count;
+        std::uint64_t tick;
+        bool keyframe;
+    };
+
+    MappedFile m_file;
+    std::vector<Chunk> m_chunks;
+
+    // Indices into m_chunks of every chunk that can be read without its predecessors
+    std::vector<std::size_t> m_keyframes;
+
+    TrajectoryDecoder m_decoder;
+
+    // Index of the chunk currently held in the buffers below, m_chunks.size() if none
+    std::size_t m_current;
+
+    // Decoded state of the current chunk, unused for raw chunks
+    std::vector<glm::vec2> m_positions;
+    std::vector<glm::vec2> m_velocities;
+
+    // State of the current chunk, either into the mapping or into the buffers above
+    const glm::vec2* m_currentPositions = nullptr;
+    const glm::vec2* m_currentVelocities = nullptr;
+
+    // Decode chunk index into the current state, which must follow m_current if it is a delta
+    bool decode(const std::size_t index);
+
+public:
+    explicit TrajectoryReader(const std::string& path);
+
+    TrajectoryReader(const TrajectoryReader&) = delete;
+    TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+    // True if the file was mapped and contained a valid header
+    explicit operator bool() const { return static_cast<bool>(m_file) && !m_chunks.empty(); }
+
+    // Number of recorded ticks
+    std::size_t frameCount() const { return m_chunks.size(); }
+
+    // Make frame the current frame, decoding from the closest keyframe before it if needed
+    bool seek(const std::size_t frame);
+
+    // Index of the current frame
+    std::size_t frame() const { return m_current; }
+
+    // State of the current frame
+    const glm::vec2* positions() const { return m_currentPositions; }
+    const glm::vec2* velocities() const { return m_currentVelocities; }
+    unsigned count() const { return m_chunks[m_current].count; }
+    std::uint64_t tick() const { return m_chunks[m_current].tick; }
+};
+
+#endif // REPLAY_H
@@ -0,0 +1,239 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <cstddef>
+#include <tuple>
+#include <utility>
+
+#include "glm/glm.hpp"
+
+// A steering rule is a plain type with the following members:
+//
+//   struct Accumulator;      Per boid state gathered while visiting neighbours
+//   bool needsNeighbours;    Static constant, false if only the boid itself is looked at
+//   float radius() const;    Neighbourhood radius (ignored if needsNeighbours is false)
+//   void accumulate(Accumulator&, const Boid& self, const Boid& other, const glm::vec2& diff,
+//                   float distance) const;
+//   glm::vec2 finalize(const Accumulator&, const Boid& self) const;
+//
+// Rules are composed into a RulePipeline at compile time. The pipeline walks the neighbour set
+// once and hands every neighbour to each rule in turn, so the compiler inlines all of them into
+// a single loop and adding a rule does not add another pass.
+
+// The parts of a boid a rule may look at
+struct Boid
+{
+    glm::vec2 position;
+    glm::vec2 velocity;
+};
+
+// True if diff (from a boid to another) lies inside the field of view around velocity v
+inline bool inFieldOfView(const glm::vec2& v, const glm::vec2& diff)
+{
+    const float angle = glm::acos(glm::dot(v, diff) / (glm::length(v) * glm::length(diff)));
+    return angle < 45.f * 3.1415f / 180.f;
+}
+
+// Steer towards the centre of the visible neighbours
+struct Cohesion
+{
+    struct Accumulator
+    {
+        glm::vec2 sum{0.f, 0.f};
+        unsigned count = 0;
+    };
+    static constexpr bool needsNeighbours = true;
+
+    float range;
+    float weight;
+
+    float radius() const { return range; }
+
+    void accumulate(Accumulator& acc, const Boid&, const Boid& other, const glm::vec2&, const float distance) const
+    {
+        if (distance < range)
+        {
+            acc.sum += other.position;
+            ++acc.count;
+        }
+    }
+
+    glm::vec2 finalize(const Accumulator& acc, const Boid& self) const
+    {
+        if (acc.count == 0)
+        {
+            return glm::vec2(0.f);
+        }
+        return (acc.sum * (1.f / acc.count) - self.position) * weight;  // Since glm::vec2 does not support division
+    }
+};
+
+// Match the mean velocity of the visible neighbours
+struct Alignment
+{
+    struct Accumulator
+    {
+        glm::vec2 sum{0.f, 0.f};
+        unsigned count = 0;
+    };
+    static constexpr bool needsNeighbours = true;
+
+    float range;
+    float weight;
+
+    float radius() const { return range; }
+
+    void accumulate(Accumulator& acc, const Boid&, const Boid& other, const glm::vec2&, const float distance) const
+    {
+        if (distance < range)
+        {
+            acc.sum += other.velocity;
+            ++acc.count;
+        }
+    }
+
+    glm::vec2 finalize(const Accumulator& acc, const Boid& self) const
+    {
+        if (acc.count == 0)
+        {
+            return glm::vec2(0.f);
+        }
+        return (acc.sum * (1.f / acc.count) - self.velocity) * weight;
+    }
+};
+
+// Push away from visible neighbours that are too close
+struct Separation
+{
+    struct Accumulator
+    {
+        glm::vec2 sum{0.f, 0.f};
+    };
+    static constexpr bool needsNeighbours = true;
+
+    float range;
+    float weight;
+
+    float radius() const { return range; }
+
+    void accumulate(Accumulator& acc, const Boid&, const Boid&, const glm::vec2& diff, const float distance) const
+    {
+        if (distance < range)
+        {
+            acc.sum += diff;
+        }
+    }
+
+    glm::vec2 finalize(const Accumulator& acc, const Boid&) const { return acc.sum * weight; }
+};
+
+// Steer towards a target location (the cursor)
+struct SeekTarget
+{
+    struct Accumulator
+    {
+    };
+    static constexpr bool needsNeighbours = false;
+
+    glm::vec2 target;
+    float weight;
+
+    float radius() const { return 0.f; }
+
+    void accumulate(Accumulator&, const Boid&, const Boid&, const glm::vec2&, const float) const {}
+
+    glm::vec2 finalize(const Accumulator&, const Boid& self) const { return (target - self.position) * weight; }
+};
+
+// A fixed set of rules evaluated together over one neighbourhood
+template <typename... Rules>
+class RulePipeline
+{
+public:
+    using Accumulators = std::tuple<typename Rules::Accumulator...>;
+
+    static constexpr bool needsNeighbours = (Rules::needsNeighbours || ...);
+
+private:
+    std::tuple<Rules...> m_rules;
+
+    template <std::size_t... I>
+    void accumulate(Accumulators& acc, const Boid& self, const Boid& other, const glm::vec2& diff,
+                    const float distance, std::index_sequence<I...>) const
+    {
+        (std::get<I>(m_rules).accumulate(std::get<I>(acc), self, other, diff, distance), ...);
+    }
+
+    template <std::size_t... I>
+    glm::vec2 finalize(const Accumulators& acc, const Boid& self, std::index_sequence<I...>) const
+    {
+        return (glm::vec2(0.f) + ... + std::get<I>(m_rules).finalize(std::get<I>(acc), self));
+    }
+
+public:
+    explicit RulePipeline(Rules... rules) : m_rules(std::move(rules)...) {}
+
+    // Access a rule to change its parameters
+    template <typename Rule>
+    Rule& rule()
+    {
+        return std::get<Rule>(m_rules);
+    }
+
+    template <typename Rule>
+    const Rule& rule() const
+    {
+        return std::get<Rule>(m_rules);
+    }
+
+    // Largest radius of any rule, i.e. how far the neighbour search has to look
+    float radius() const
+    {
+        float r = 0.f;
+        std::apply([&](const auto&... rule) { ((r = glm::max(r, rule.radius())), ...); }, m_rules);
+        return r;
+    }
+
+    // Gather the neighbours of boid i from a grid into acc. Neighbours must be within radius()
+    // and inside the boid's field of view. visit(j, distance) additionally sees every other boid
+    // the grid returns, before any filtering, so callers can piggyback on the same distances.
+    template <typename Grid, typename Positions, typename Velocities, typename Visit>
+    void gather(Accumulators& acc, const unsigned i, const Grid& grid, const Positions& positions,
+                const Velocities& velocities, Visit&& visit) const
+    {
+        if constexpr (needsNeighbours)
+        {
+            const Boid self{positions[i], velocities[i]};
+            const float range = radius();
+            grid.forEachNear(self.position, [&](const unsigned j) {
+                if (j == i)
+                {
+                    return;
+                }
+                const auto diff = positions[j] - self.position;
+                const float distance = glm::length(diff);
+                visit(j, distance);
+                if (distance < range && inFieldOfView(self.velocity, diff))
+                {
+                    accumulate(acc, self, Boid{positions[j], velocities[j]}, diff, distance,
+                               std::index_sequence_for<Rules...>{});
+                }
+            });
+        }
+    }
+
+    template <typename Grid, typename Positions, typename Velocities>
+    void gather(Accumulators& acc, const unsigned i, const Grid& grid, const Positions& positions,
+                const Velocities& velocities) const
+    {
+        gather(acc, i, grid, positions, velocities, [](unsigned, float) {});
+    }
+
+    // Sum of the steering of all rules for a boid
+    glm::vec2 finalize(const Accumulators& acc, const Boid& self) const
+    {
+        return finalize(acc, self, std::index_sequence_for<Rules...>{});
+    }
+};
+
+#endif // RULES_H
@@ -0,0 +1,262 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+std::uint64_t pack(const TaskRange& range)
+{
+    return static_cast<std::uint64_t>(range.last) << 32 | range.first;
+}
+
+TaskRange unpack(const std::uint64_t item)
+{
+    return {static_cast<unsigned>(item), static_cast<unsigned>(item >> 32)};
+}
+} // namespace
+
+void WorkDeque::reset(const std::size_t capacity)
+{
+    std::size_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    if (static_cast<std::int64_t>(size) - 1 > m_mask)
+    {
+        m_items = std::make_unique<std::atomic<std::uint64_t>[]>(size);
+        m_mask = static_cast<std::int64_t>(size) - 1;
+    }
+    m_top.store(0, std::memory_order_relaxed);
+    m_bottom.store(0, std::memory_order_relaxed);
+}
+
+void WorkDeque::push(const TaskRange& range)
+{
+    const auto b = m_bottom.load(std::memory_order_relaxed);
+    m_items[b & m_mask].store(pack(range), std::memory_order_relaxed);
+    m_bottom.store(b + 1, std::memory_order_release);
+}
+
+bool WorkDeque::pop(TaskRange& range)
+{
+    const auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = m_top.load(std::memory_order_relaxed);
+    if (t > b)
+    {
+        // Already empty
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    range = unpack(m_items[b & m_mask].load(std::memory_order_relaxed));
+    if (t == b)
+    {
+        // Last item, race the thieves for it
+        const bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                       std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool WorkDeque::steal(TaskRange& range)
+{
+    auto t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b)
+    {
+        return false;
+    }
+
+    range = unpack(m_items[t & m_mask].load(std::memory_order_relaxed));
+    return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+Scheduler::Scheduler(const unsigned workers)
+{
+    resize(workers);
+}
+
+Scheduler::~Scheduler()
+{
+    stop();
+}
+
+void Scheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+    m_threads.clear();
+    m_stop = false;
+}
+
+void Scheduler::resize(const unsigned workers, const bool pin)
+{
+    stop();
+    m_deques.clear();
+    for (unsigned w = 0; w < std::max(workers, 1u); ++w)
+    {
+        m_deques.push_back(std::make_unique<WorkDeque>());
+    }
+    // Worker 0 is whoever calls run(). The others start from the current generation, since no
+    // batch can be dispatched before resize() returns.
+    for (unsigned w = 1; w < workers; ++w)
+    {
+        m_threads.emplace_back(&Scheduler::loop, this, w, m_generation);
+    }
+
+#ifdef __linux__
+    if (pin)
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu != CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        for (std::size_t t = 0; t != m_threads.size() && t + 1 < cpus.size(); ++t)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[t + 1], &set);
+            pthread_setaffinity_np(m_threads[t].native_handle(), sizeof(set), &set);
+        }
+    }
+#else
+    (void)pin;
+#endif
+}
+
+void Scheduler::loop(const unsigned worker, unsigned seen)
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+            if (m_stop)
+            {
+                return;
+            }
+            seen = m_generation;
+        }
+
+        work(worker);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busy == 0)
+        {
+            m_done.notify_one();
+        }
+    }
+}
+
+bool Scheduler::take(const unsigned worker, TaskRange& range)
+{
+    const auto count = static_cast<unsigned>(m_deques.size());
+    bool found = m_deques[worker]->pop(range);
+    for (unsigned k = 1; !found && k != count; ++k)
+    {
+        found = m_deques[(worker + k) % count]->steal(range);
+    }
+    return found;
+}
+
+void Scheduler::work(const unsigned worker)
+{
+    TaskRange range;
+    while (m_remaining.load(std::memory_order_acquire) != 0)
+    {
+        if (take(worker, range))
+        {
+            m_body(m_context, range, worker);
+            m_remaining.fetch_sub(1, std::memory_order_acq_rel);
+        }
+        else
+        {
+            // Everything left is running elsewhere
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool Scheduler::help()
+{
+    TaskRange range;
+    if (!take(0, range))
+    {
+        return false;
+    }
+    m_body(m_context, range, 0);
+    m_remaining.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+void Scheduler::start(const std::vector<TaskRange>& ranges, const Body body, void* context)
+{
+    // Deal contiguous blocks, pushed backwards so each owner pops its block front to back
+    // while thieves take from the far end
+    const auto count = m_deques.size();
+    const auto perWorker = (ranges.size() + count - 1) / count;
+    for (std::size_t w = 0; w != count; ++w)
+    {
+        const auto first = std::min(ranges.size(), w * perWorker);
+        const auto last = std::min(ranges.size(), first + perWorker);
+        m_deques[w]->reset(perWorker);
+        for (auto k = last; k != first; --k)
+        {
+            m_deques[w]->push(ranges[k - 1]);
+        }
+    }
+    m_remaining.store(static_cast<unsigned>(ranges.size()), std::memory_order_relaxed);
+
+    // Without pool threads everything runs in finish() (or help()) on the calling thread
+    if (m_threads.empty())
+    {
+        m_body = body;
+        m_context = context;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_body = body;
+        m_context = context;
+        m_busy = static_cast<unsigned>(m_threads.size());
+        ++m_generation;
+    }
+    m_wake.notify_all();
+}
+
+void Scheduler::finish()
+{
+    work(0);
+
+    if (!m_threads.empty())
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [&] { return m_busy == 0; });
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A half-open range of work items, e.g. positions in a grid's sorted boid order
+struct TaskRange
+{
+    unsigned first;
+    unsigned last;
+};
+
+// Chase-Lev work-stealing deque of ranges. The owning worker pushes and pops at the bottom,
+// any other worker steals from the top. Capacity is fixed between resets, which only happen
+// while no worker is using the deque.
+class WorkDeque
+{
+private:
+    std::unique_ptr<std::atomic<std::uint64_t>[]> m_items;
+    std::int64_t m_mask = -1;
+
+    alignas(64) std::atomic<std::int64_t> m_top{0};
+    alignas(64) std::atomic<std::int64_t> m_bottom{0};
+
+public:
+    // Empty the deque and make room for at least capacity ranges
+    void reset(const std::size_t capacity);
+
+    // Owner only
+    void push(const TaskRange& range);
+    bool pop(TaskRange& range);
+
+    // Any worker, may fail spuriously when racing another thief or the owner
+    bool steal(TaskRange& range);
+};
+
+// Fixed pool of worker threads running one batch of ranges at a time. Ranges are dealt out in
+// contiguous blocks, one per worker, so neighbouring ranges tend to run on the same core, and
+// idle workers steal from the others until the whole batch is done.
+class Scheduler
+{
+private:
+    using Body = void (*)(void* context, const TaskRange& range, unsigned worker);
+
+    std::vector<std::thread> m_threads;
+    std::vector<std::unique_ptr<WorkDeque>> m_deques;
+
+    // Current batch, published under m_mutex by bumping m_generation
+    Body m_body = nullptr;
+    void* m_context = nullptr;
+    unsigned m_generation = 0;
+    unsigned m_busy = 0;
+    bool m_stop = false;
+
+    // Ranges of the current batch not finished yet
+    alignas(64) std::atomic<unsigned> m_remaining{0};
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    void stop();
+    void loop(const unsigned worker, unsigned seen);
+    bool take(const unsigned worker, TaskRange& range);
+    void work(const unsigned worker);
+    void start(const std::vector<TaskRange>& ranges, Body body, void* context);
+
+public:
+    // workers includes the calling thread, so 1 runs everything inline
+    explicit Scheduler(const unsigned workers = 1);
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    ~Scheduler();
+
+    // Restart with a different number of workers. pin binds each pool thread to its own CPU, in
+    // the order the process may run on them, leaving the first one to the calling thread.
+    // Ignored where affinity is not supported.
+    void resize(const unsigned workers, const bool pin = false);
+
+    unsigned workers() const { return static_cast<unsigned>(m_deques.size()); }
+
+    // Start calling f(range, worker) for every range on the pool threads and return without
+    // waiting, so the calling thread can do something else meanwhile. worker is below workers()
+    // and identifies the calling thread, e.g. to pick per-thread scratch. f and ranges must stay
+    // alive until finish() returns.
+    template <typename F>
+    void start(const std::vector<TaskRange>& ranges, F& f)
+    {
+        start(ranges,
+              [](void* context, const TaskRange& range, const unsigned worker) {
+                  (*static_cast<F*>(context))(range, worker);
+              },
+              &f);
+    }
+
+    // Run one range of the started batch on the calling thread, false if none is left to take
+    bool help();
+
+    // Help with the started batch until it is done, then return
+    void finish();
+
+    // start() and finish()
+    template <typename F>
+    void run(const std::vector<TaskRange>& ranges, F&& f)
+    {
+        start(ranges, f);
+        finish();
+    }
+};
+
+#endif // SCHEDULER_H
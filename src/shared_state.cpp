@@ -0,0 +1,177 @@
+#include "shared_state.h"
+
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+// Alignment of the arrays in the segment
+constexpr std::size_t arrayAlignment = 64;
+
+std::size_t alignUp(const std::size_t offset)
+{
+    return (offset + arrayAlignment - 1) / arrayAlignment * arrayAlignment;
+}
+
+// True if capacity glm::vec2 at offset lie past the header and within size bytes. The values
+// come from another process, so this is written not to overflow on any of them.
+bool arrayFits(const std::uint64_t offset, const std::uint64_t capacity, const std::size_t size)
+{
+    return offset >= sizeof(SharedStateHeader) && offset % alignof(glm::vec2) == 0 && offset <= size &&
+           capacity <= (size - offset) / sizeof(glm::vec2);
+}
+} // namespace
+
+SharedStateWriter::SharedStateWriter(const std::string& name, const unsigned capacity) : m_name(name)
+{
+    const auto arraySize = alignUp(sizeof(glm::vec2) * capacity);
+    m_size = alignUp(sizeof(SharedStateHeader)) + 4 * arraySize;
+
+    const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cout << "Failed to create shared memory " << name << "!\n";
+        return;
+    }
+    if (ftruncate(fd, static_cast<off_t>(m_size)) != 0)
+    {
+        std::cout << "Failed to size shared memory " << name << "!\n";
+        close(fd);
+        shm_unlink(name.c_str());
+        return;
+    }
+    void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        std::cout << "Failed to map shared memory " << name << "!\n";
+        shm_unlink(name.c_str());
+        return;
+    }
+    m_data = static_cast<unsigned char*>(data);
+
+    // The segment starts zeroed, so only the header needs filling in. Readers check the magic
+    // last, hence it is written after everything else.
+    auto* h = new (m_data) SharedStateHeader{};
+    h->version = sharedStateVersion;
+    h->headerSize = sizeof(SharedStateHeader);
+    h->capacity = capacity;
+    for (unsigned s = 0; s != 2; ++s)
+    {
+        h->slots[s].positionsOffset = alignUp(sizeof(SharedStateHeader)) + (2 * s) * arraySize;
+        h->slots[s].velocitiesOffset = alignUp(sizeof(SharedStateHeader)) + (2 * s + 1) * arraySize;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(h->magic, sharedStateMagic, sizeof(h->magic));
+}
+
+SharedStateWriter::~SharedStateWriter()
+{
+    if (m_data)
+    {
+        munmap(m_data, m_size);
+        shm_unlink(m_name.c_str());
+    }
+}
+
+void SharedStateWriter::publish(const std::uint64_t tick, const glm::vec2* positions, const glm::vec2* velocities,
+                                const unsigned count)
+{
+    if (!m_data)
+    {
+        return;
+    }
+
+    auto* h = header();
+    if (count > h->capacity)
+    {
+        if (!m_warned)
+        {
+            std::cout << "Flock outgrew shared memory " << m_name << ", not exporting!\n";
+            m_warned = true;
+        }
+        return;
+    }
+
+    // Fill the slot readers are not currently directed to
+    const auto generation = h->generation.load(std::memory_order_relaxed) + 1;
+    auto& slot = h->slots[generation % 2];
+
+    const auto sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.tick = tick;
+    slot.count = count;
+    std::memcpy(m_data + slot.positionsOffset, positions, sizeof(glm::vec2) * count);
+    std::memcpy(m_data + slot.velocitiesOffset, velocities, sizeof(glm::vec2) * count);
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    h->generation.store(generation, std::memory_order_release);
+}
+
+SharedStateReader::SharedStateReader(const std::string& name)
+{
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        std::cout << "Failed to open shared memory " << name << "!\n";
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(SharedStateHeader))
+    {
+        std::cout << "Shared memory " << name << " is not initialized!\n";
+        close(fd);
+        return;
+    }
+    m_size = static_cast<std::size_t>(info.st_size);
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        std::cout << "Failed to map shared memory " << name << "!\n";
+        return;
+    }
+
+    const auto* h = static_cast<const SharedStateHeader*>(data);
+    if (std::memcmp(h->magic, sharedStateMagic, sizeof(h->magic)) != 0 || h->version != sharedStateVersion ||
+        h->headerSize != sizeof(SharedStateHeader))
+    {
+        std::cout << "Shared memory " << name << " has an unsupported layout!\n";
+        munmap(data, m_size);
+        return;
+    }
+
+    // The writer fills in the layout before the magic
+    std::atomic_thread_fence(std::memory_order_acquire);
+    m_capacity = h->capacity;
+    for (unsigned s = 0; s != 2; ++s)
+    {
+        m_positionsOffsets[s] = h->slots[s].positionsOffset;
+        m_velocitiesOffsets[s] = h->slots[s].velocitiesOffset;
+        if (!arrayFits(m_positionsOffsets[s], m_capacity, m_size) ||
+            !arrayFits(m_velocitiesOffsets[s], m_capacity, m_size))
+        {
+            std::cout << "Shared memory " << name << " is too small for its slots!\n";
+            munmap(data, m_size);
+            return;
+        }
+    }
+    m_data = static_cast<const unsigned char*>(data);
+}
+
+SharedStateReader::~SharedStateReader()
+{
+    if (m_data)
+    {
+        munmap(const_cast<unsigned char*>(m_data), m_size);
+    }
+}
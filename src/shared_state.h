@@ -0,0 +1,158 @@
+#ifndef SHARED_STATE_H
+#define SHARED_STATE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "glm/glm.hpp"
+
+// Live export of flock state to other processes through a POSIX shared memory segment.
+//
+// The segment holds a header and two slots of positions/velocities. The writer fills the slot
+// readers are not directed to, guarded by that slot's sequence counter (odd while writing), then
+// points the generation counter at it. Readers never take a lock and the writer never waits for
+// them: a reader that overlaps a write simply sees the sequence change and retries.
+
+constexpr char sharedStateMagic[8] = {'B', 'O', 'I', 'D', 'S', 'H', 'M', '\0'};
+
+// Bump whenever the layout of the segment changes
+constexpr std::uint32_t sharedStateVersion = 1;
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "Shared memory needs lock free atomics");
+
+struct SharedStateSlot
+{
+    // Odd while the writer is filling the slot
+    std::atomic<std::uint64_t> sequence;
+
+    std::uint64_t tick;
+    std::uint32_t count;
+    std::uint32_t padding;
+
+    // Offsets of the count glm::vec2 positions and velocities from the start of the segment
+    std::uint64_t positionsOffset;
+    std::uint64_t velocitiesOffset;
+};
+
+struct SharedStateHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerSize;
+
+    // Boids each slot has room for
+    std::uint64_t capacity;
+
+    // Incremented on every publish, the latest slot is generation % 2
+    std::atomic<std::uint64_t> generation;
+
+    SharedStateSlot slots[2];
+};
+
+// Creates the segment and publishes ticks into it
+class SharedStateWriter
+{
+private:
+    std::string m_name;
+    unsigned char* m_data = nullptr;
+    std::size_t m_size = 0;
+
+    // Whether a publish beyond capacity has already been reported
+    bool m_warned = false;
+
+    SharedStateHeader* header() const { return reinterpret_cast<SharedStateHeader*>(m_data); }
+
+public:
+    // name follows shm_open rules, e.g. "/boids". The segment is removed on destruction.
+    SharedStateWriter(const std::string& name, const unsigned capacity);
+
+    SharedStateWriter(const SharedStateWriter&) = delete;
+    SharedStateWriter& operator=(const SharedStateWriter&) = delete;
+
+    ~SharedStateWriter();
+
+    explicit operator bool() const { return m_data != nullptr; }
+
+    // Copy one tick into the segment. Never blocks; ticks beyond capacity are skipped.
+    void publish(const std::uint64_t tick, const glm::vec2* positions, const glm::vec2* velocities,
+                 const unsigned count);
+};
+
+// Consistent view of one published tick, pointing straight into the segment
+struct SharedStateView
+{
+    std::uint64_t tick;
+    unsigned count;
+    const glm::vec2* positions;
+    const glm::vec2* velocities;
+};
+
+// Maps an existing segment read-only
+class SharedStateReader
+{
+private:
+    const unsigned char* m_data = nullptr;
+    std::size_t m_size = 0;
+
+    // Layout of the slots, checked against the size of the segment when it was opened and used
+    // from then on instead of the header, which the writer's process could still change
+    std::uint64_t m_capacity = 0;
+    std::uint64_t m_positionsOffsets[2] = {};
+    std::uint64_t m_velocitiesOffsets[2] = {};
+
+    // Last generation handed to a reader
+    std::uint64_t m_generation = 0;
+
+    const SharedStateHeader* header() const { return reinterpret_cast<const SharedStateHeader*>(m_data); }
+
+public:
+    // Prints the problem and stays invalid if the segment is missing, of another version, or its
+    // slots do not fit in it
+    explicit SharedStateReader(const std::string& name);
+
+    SharedStateReader(const SharedStateReader&) = delete;
+    SharedStateReader& operator=(const SharedStateReader&) = delete;
+
+    ~SharedStateReader();
+
+    explicit operator bool() const { return m_data != nullptr; }
+
+    // Call f(const SharedStateView&) on the latest tick, in place and without copying. Returns
+    // false if nothing new was published since the last call, or if the writer overwrote the
+    // slot while f ran, in which case whatever f produced must be discarded.
+    template <typename F>
+    bool read(F&& f)
+    {
+        const auto* h = header();
+        const auto generation = h->generation.load(std::memory_order_acquire);
+        if (generation == 0 || generation == m_generation)
+        {
+            return false;
+        }
+
+        const auto s = generation % 2;
+        const auto& slot = h->slots[s];
+        const auto before = slot.sequence.load(std::memory_order_acquire);
+        if (before % 2 != 0 || slot.count > m_capacity)
+        {
+            return false;
+        }
+
+        const SharedStateView view{slot.tick, slot.count,
+                                   reinterpret_cast<const glm::vec2*>(m_data + m_positionsOffsets[s]),
+                                   reinterpret_cast<const glm::vec2*>(m_data + m_velocitiesOffsets[s])};
+        f(view);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != before)
+        {
+            return false;
+        }
+        m_generation = generation;
+        return true;
+    }
+};
+
+#endif // SHARED_STATE_H
@@ -0,0 +1,570 @@
+#include "slabs.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "channel.h"
+#include "flock.h"
+
+namespace
+{
+// Seed shared by every process, so they all agree on the initial flock
+constexpr std::uint32_t slabSeed = 1;
+
+// Width and height of the area Flock spawns its initial boids in
+constexpr float spawnSize = 800.f;
+
+// Location the boids are attracted to, as in the batch runner
+const glm::vec2 slabTarget(400.f, 400.f);
+
+// What every worker reports to the coordinator after each tick
+struct TickReport
+{
+    std::uint32_t count;
+    std::uint32_t ghosts;
+    double seconds;
+};
+
+// Number of intervals a worker splits its boids into when describing where they are
+constexpr unsigned quantileCount = 16;
+
+// CPU time used by the calling thread
+double cpuSeconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// True if the workers and the coordinator move the borders after tick t
+bool isRebalanceTick(const unsigned t, const unsigned interval, const unsigned ticks)
+{
+    return interval != 0 && (t + 1) % interval == 0 && t + 1 != ticks;
+}
+
+// A set of boids sent between slabs, encoded as count, positions, velocities
+struct BoidBatch
+{
+    std::vector<glm::vec2> positions;
+    std::vector<glm::vec2> velocities;
+
+    void clear()
+    {
+        positions.clear();
+        velocities.clear();
+    }
+
+    void add(const glm::vec2& position, const glm::vec2& velocity)
+    {
+        positions.push_back(position);
+        velocities.push_back(velocity);
+    }
+
+    void encode(std::vector<unsigned char>& message) const
+    {
+        const auto count = static_cast<std::uint32_t>(positions.size());
+        message.resize(sizeof(count) + 2 * sizeof(glm::vec2) * count);
+        std::memcpy(message.data(), &count, sizeof(count));
+        std::memcpy(message.data() + sizeof(count), positions.data(), sizeof(glm::vec2) * count);
+        std::memcpy(message.data() + sizeof(count) + sizeof(glm::vec2) * count, velocities.data(),
+                    sizeof(glm::vec2) * count);
+    }
+
+    // Append the boids in message, returns false if it is malformed
+    bool decodeAppend(const std::vector<unsigned char>& message)
+    {
+        std::uint32_t count;
+        if (message.size() < sizeof(count))
+        {
+            return false;
+        }
+        std::memcpy(&count, message.data(), sizeof(count));
+        if (message.size() != sizeof(count) + 2 * sizeof(glm::vec2) * count)
+        {
+            return false;
+        }
+        const auto first = positions.size();
+        positions.resize(first + count);
+        velocities.resize(first + count);
+        std::memcpy(positions.data() + first, message.data() + sizeof(count), sizeof(glm::vec2) * count);
+        std::memcpy(velocities.data() + first, message.data() + sizeof(count) + sizeof(glm::vec2) * count,
+                    sizeof(glm::vec2) * count);
+        return true;
+    }
+};
+
+// Send outLeft/outRight to the neighbours that exist and append what they send into in
+bool exchangeWithNeighbours(Channel& left, Channel& right, const BoidBatch& outLeft, const BoidBatch& outRight,
+                            BoidBatch& in)
+{
+    std::vector<unsigned char> sendLeft, sendRight, receiveLeft, receiveRight;
+    std::vector<Transfer> transfers;
+    if (left)
+    {
+        outLeft.encode(sendLeft);
+        transfers.push_back({&left, &sendLeft, &receiveLeft});
+    }
+    if (right)
+    {
+        outRight.encode(sendRight);
+        transfers.push_back({&right, &sendRight, &receiveRight});
+    }
+    if (!exchange(transfers))
+    {
+        return false;
+    }
+
+    in.clear();
+    return (!left || in.decodeAppend(receiveLeft)) && (!right || in.decodeAppend(receiveRight));
+}
+
+// Hand boids outside [lo, hi) to the neighbours and take in the ones they hand over. Walking
+// backwards means the boid despawn() swaps into place has already been looked at.
+bool handOver(Flock& flock, const float lo, const float hi, Channel& left, Channel& right, BoidBatch& outLeft,
+              BoidBatch& outRight, BoidBatch& in)
+{
+    outLeft.clear();
+    outRight.clear();
+    for (auto i = flock.count(); i-- != 0;)
+    {
+        const auto p = flock.positions()[i];
+        const auto v = flock.velocities()[i];
+        if (p.x < lo || p.x >= hi)
+        {
+            (p.x < lo ? outLeft : outRight).add(p, v);
+            flock.despawn(i);
+        }
+    }
+    if (!exchangeWithNeighbours(left, right, outLeft, outRight, in))
+    {
+        return false;
+    }
+    for (std::size_t k = 0; k != in.positions.size(); ++k)
+    {
+        flock.spawn(in.positions[k], in.velocities[k]);
+    }
+    return true;
+}
+
+// quantileCount + 1 evenly spaced quantiles of the x coordinates in the flock, or nothing if empty
+std::vector<float> quantiles(const Flock& flock)
+{
+    std::vector<float> xs(flock.count());
+    for (unsigned i = 0; i != flock.count(); ++i)
+    {
+        xs[i] = flock.positions()[i].x;
+    }
+    std::sort(xs.begin(), xs.end());
+
+    std::vector<float> q;
+    if (!xs.empty())
+    {
+        for (unsigned k = 0; k <= quantileCount; ++k)
+        {
+            q.push_back(xs[k * (xs.size() - 1) / quantileCount]);
+        }
+    }
+    return q;
+}
+
+// Move the inner borders so every slab gets an equal share of the measured cost. The cost of a
+// slab is spread evenly over its boids, whose distribution is given by their quantiles, which
+// makes the total cost a piecewise linear function of x that is cut into equal parts. A border
+// never moves past the old border of an adjacent slab, so a boid is never more than one slab
+// from its new owner, and slabs stay at least minWidth wide so ghosts only come from neighbours.
+void rebalance(std::vector<float>& borders, const std::vector<double>& costs,
+               const std::vector<std::vector<float>>& quantiles, const float minWidth)
+{
+    std::vector<std::pair<float, double>> knots;
+    double total = 0.0;
+    for (std::size_t s = 0; s != costs.size(); ++s)
+    {
+        const auto& q = quantiles[s];
+        if (q.size() < 2)
+        {
+            continue;
+        }
+        const double perInterval = costs[s] / (q.size() - 1);
+        knots.emplace_back(q[0], total);
+        for (std::size_t k = 1; k != q.size(); ++k)
+        {
+            total += perInterval;
+            knots.emplace_back(q[k], total);
+        }
+    }
+    if (knots.size() < 2 || total <= 0.0)
+    {
+        return;
+    }
+
+    const auto slabs = costs.size();
+    const auto old = borders;
+    std::size_t k = 1;
+    for (std::size_t s = 1; s != slabs; ++s)
+    {
+        const double share = total * s / slabs;
+        while (k + 1 < knots.size() && knots[k].second < share)
+        {
+            ++k;
+        }
+        const auto& [x0, c0] = knots[k - 1];
+        const auto& [x1, c1] = knots[k];
+        const float target = c1 > c0 ? x0 + (x1 - x0) * static_cast<float>((share - c0) / (c1 - c0)) : x1;
+
+        const float lo = std::max(old[s - 1], borders[s - 1]) + minWidth;
+        const float hi = old[s + 1] - minWidth;
+        if (lo <= hi)
+        {
+            borders[s] = std::clamp(target, lo, hi);
+        }
+    }
+}
+
+// The boids in [lo, hi) along x of the flock of count boids every worker agrees on. They are
+// drawn like Flock's constructor does from slabSeed, all positions first and then all
+// velocities, but only this slab's share is kept so no worker holds storage for every boid.
+BoidBatch initialBoids(const unsigned count, const float lo, const float hi)
+{
+    std::uniform_real_distribution<float> rng(0.f, 1.f);
+    std::mt19937 positions(slabSeed), velocities(slabSeed);
+    for (unsigned i = 0; i != 2 * count; ++i)
+    {
+        rng(velocities);
+    }
+
+    BoidBatch own;
+    for (unsigned i = 0; i != count; ++i)
+    {
+        glm::vec2 p, v;
+        p.x = rng(positions) * spawnSize;
+        p.y = rng(positions) * spawnSize;
+        v.x = rng(velocities) * 0.4f;
+        v.y = rng(velocities) * 0.4f;
+        if (p.x >= lo && p.x < hi)
+        {
+            own.add(p, v);
+        }
+    }
+    return own;
+}
+
+// Simulate the boids in [lo, hi) along x, moving the borders when the coordinator says so
+int runWorker(const unsigned slab, float lo, float hi, const unsigned boids, const unsigned ticks,
+              const unsigned rebalanceInterval, Channel& left, Channel& right, Channel& coordinator)
+{
+    // Room for this slab's share only, spawning grows it as boids come in
+    BoidBatch outLeft, outRight, in = initialBoids(boids, lo, hi);
+    FlockParams params;
+    params.seed = slabSeed;
+    Flock flock(0, in.positions.size(), params);
+    flock.setTarget(slabTarget);
+    for (std::size_t k = 0; k != in.positions.size(); ++k)
+    {
+        flock.spawn(in.positions[k], in.velocities[k]);
+    }
+
+    const float margin = params.neighbourDistance;
+    for (unsigned t = 0; t != ticks; ++t)
+    {
+        // Ghosts, every boid close enough to a border to be seen from the other side
+        outLeft.clear();
+        outRight.clear();
+        for (unsigned i = 0; i != flock.count(); ++i)
+        {
+            const auto& p = flock.positions()[i];
+            const auto& v = flock.velocities()[i];
+            if (p.x < lo + margin)
+                outLeft.add(p, v);
+            if (p.x >= hi - margin)
+                outRight.add(p, v);
+        }
+        if (!exchangeWithNeighbours(left, right, outLeft, outRight, in))
+        {
+            std::cout << "Slab " << slab << " lost its neighbours!\n";
+            return 1;
+        }
+        flock.setGhosts(in.positions.data(), in.velocities.data(), static_cast<unsigned>(in.positions.size()));
+        const auto ghosts = static_cast<std::uint32_t>(in.positions.size());
+
+        // Only the simulation itself is timed, waiting on neighbours would hide the imbalance. CPU
+        // time rather than wall time, so workers sharing a core do not charge each other.
+        const double start = cpuSeconds();
+        flock.update(1.f / 120.f);
+        const double elapsed = cpuSeconds() - start;
+
+        // Migration, boids that left the slab are handed over
+        if (!handOver(flock, lo, hi, left, right, outLeft, outRight, in))
+        {
+            std::cout << "Slab " << slab << " lost its neighbours!\n";
+            return 1;
+        }
+
+        const TickReport report{flock.count(), ghosts, elapsed};
+        std::vector<unsigned char> message(sizeof(report));
+        std::memcpy(message.data(), &report, sizeof(report));
+        if (!coordinator.send(message))
+        {
+            return 1;
+        }
+
+        // Describe where the boids are, get new borders and hand over what is no longer ours
+        if (isRebalanceTick(t, rebalanceInterval, ticks))
+        {
+            const auto q = quantiles(flock);
+            message.resize(sizeof(float) * q.size());
+            std::memcpy(message.data(), q.data(), message.size());
+            if (!coordinator.send(message) || !coordinator.receive(message) || message.size() != 2 * sizeof(float))
+            {
+                return 1;
+            }
+            std::memcpy(&lo, message.data(), sizeof(float));
+            std::memcpy(&hi, message.data() + sizeof(float), sizeof(float));
+            if (!handOver(flock, lo, hi, left, right, outLeft, outRight, in))
+            {
+                std::cout << "Slab " << slab << " lost its neighbours!\n";
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+} // namespace
+
+int runSlabs(const unsigned processes, const unsigned boids, const unsigned ticks, const unsigned rebalanceInterval)
+{
+    if (processes == 0)
+    {
+        std::cout << "Need at least one slab!\n";
+        return 1;
+    }
+
+    // Ghosts only come from the adjacent slabs, so no slab between two others may be narrower
+    // than the distance boids see, rebalancing keeps them that wide
+    const float minWidth = FlockParams{}.neighbourDistance;
+    if (processes > 2 && spawnSize / processes < minWidth)
+    {
+        std::cout << "Slabs would be narrower than the neighbour distance, use at most "
+                  << static_cast<unsigned>(spawnSize / minWidth) << "!\n";
+        return 1;
+    }
+
+    // Slabs split the initial spawn area evenly, the outer ones extend to infinity
+    std::vector<float> borders(processes + 1);
+    borders.front() = -std::numeric_limits<float>::infinity();
+    borders.back() = std::numeric_limits<float>::infinity();
+    for (unsigned s = 1; s != processes; ++s)
+    {
+        borders[s] = spawnSize * s / processes;
+    }
+
+    // neighbours[s] connects slab s - 1 (first) with slab s (second)
+    std::vector<std::pair<Channel, Channel>> neighbours(processes + 1);
+    std::vector<std::pair<Channel, Channel>> coordinators(processes);
+    for (unsigned s = 1; s < processes; ++s)
+    {
+        if (!Channel::pair(neighbours[s].first, neighbours[s].second))
+        {
+            std::cout << "Failed to connect slabs!\n";
+            return 1;
+        }
+    }
+    for (auto& c : coordinators)
+    {
+        if (!Channel::pair(c.first, c.second))
+        {
+            std::cout << "Failed to connect slabs!\n";
+            return 1;
+        }
+    }
+
+    std::cout << "Simulating " << boids << " boids in " << processes << " slab processes for " << ticks
+              << " ticks\n";
+
+    std::cout.flush();
+    std::vector<pid_t> workers;
+    for (unsigned s = 0; s != processes; ++s)
+    {
+        const pid_t pid = fork();
+        if (pid < 0)
+        {
+            std::cout << "Failed to start slab " << s << "!\n";
+            return 1;
+        }
+        if (pid == 0)
+        {
+            // Keep only this slab's ends. Nobody else holding a copy means a peer that dies is
+            // seen as a hang-up rather than waited on forever.
+            for (unsigned c = 0; c != processes + 1; ++c)
+            {
+                if (c != s)
+                {
+                    neighbours[c].second.close();
+                }
+                if (c != s + 1)
+                {
+                    neighbours[c].first.close();
+                }
+            }
+            for (unsigned c = 0; c != processes; ++c)
+            {
+                coordinators[c].first.close();
+                if (c != s)
+                {
+                    coordinators[c].second.close();
+                }
+            }
+            const int code = runWorker(s, borders[s], borders[s + 1], boids, ticks, rebalanceInterval,
+                                       neighbours[s].second, neighbours[s + 1].first, coordinators[s].second);
+            std::cout.flush();
+            _exit(code);
+        }
+        workers.push_back(pid);
+    }
+
+    // The workers own their ends now, the coordinator only keeps its side of each coordinator
+    // channel
+    for (auto& n : neighbours)
+    {
+        n.first.close();
+        n.second.close();
+    }
+    for (auto& c : coordinators)
+    {
+        c.second.close();
+    }
+
+    // Collect every worker's report each tick, the slowest worker sets the pace of all of them
+    std::vector<TickReport> reports(processes);
+    std::vector<double> costs(processes, 0.0), boidTicks(processes, 0.0);
+    std::vector<std::vector<float>> slabQuantiles(processes);
+    double totalSeconds = 0.0, idealSeconds = 0.0;
+    bool failed = false;
+    for (unsigned t = 0; t != ticks && !failed; ++t)
+    {
+        std::vector<unsigned char> message;
+        for (unsigned s = 0; s != processes; ++s)
+        {
+            if (!coordinators[s].first.receive(message) || message.size() != sizeof(TickReport))
+            {
+                std::cout << "Lost slab " << s << "!\n";
+                failed = true;
+                break;
+            }
+            std::memcpy(&reports[s], message.data(), sizeof(TickReport));
+        }
+        if (failed)
+        {
+            break;
+        }
+
+        double slowest = 0.0, sum = 0.0;
+        unsigned total = 0;
+        for (unsigned s = 0; s != processes; ++s)
+        {
+            costs[s] += reports[s].seconds;
+            boidTicks[s] += reports[s].count;
+        }
+        for (const auto& r : reports)
+        {
+            slowest = std::max(slowest, r.seconds);
+            sum += r.seconds;
+            total += r.count;
+        }
+        totalSeconds += slowest;
+        idealSeconds += sum / processes;
+
+        if ((t + 1) % 120 == 0 || t + 1 == ticks)
+        {
+            std::cout << "Tick " << t + 1 << ": " << total << " boids, slabs";
+            for (const auto& r : reports)
+            {
+                std::cout << ' ' << r.count << '+' << r.ghosts;
+            }
+            std::cout << ", " << slowest * 1000.0 << " ms, borders";
+            for (unsigned s = 1; s != processes; ++s)
+            {
+                std::cout << ' ' << borders[s];
+            }
+            std::cout << '\n';
+        }
+
+        if (isRebalanceTick(t, rebalanceInterval, ticks))
+        {
+            for (unsigned s = 0; s != processes; ++s)
+            {
+                if (!coordinators[s].first.receive(message) || message.size() % sizeof(float) != 0)
+                {
+                    std::cout << "Lost slab " << s << "!\n";
+                    failed = true;
+                    break;
+                }
+                slabQuantiles[s].resize(message.size() / sizeof(float));
+                std::memcpy(slabQuantiles[s].data(), message.data(), message.size());
+            }
+            if (failed)
+            {
+                break;
+            }
+
+            // The flock moves quickly, so rather than last interval's cost use its cost per boid
+            // times the boids each slab has now
+            const double meanPerBoid = std::accumulate(costs.begin(), costs.end(), 0.0) /
+                                       std::max(1.0, std::accumulate(boidTicks.begin(), boidTicks.end(), 0.0));
+            for (unsigned s = 0; s != processes; ++s)
+            {
+                costs[s] = (boidTicks[s] > 0.0 ? costs[s] / boidTicks[s] : meanPerBoid) * reports[s].count;
+            }
+            rebalance(borders, costs, slabQuantiles, minWidth);
+            std::fill(costs.begin(), costs.end(), 0.0);
+            std::fill(boidTicks.begin(), boidTicks.end(), 0.0);
+            for (unsigned s = 0; s != processes; ++s)
+            {
+                message.resize(2 * sizeof(float));
+                std::memcpy(message.data(), &borders[s], sizeof(float));
+                std::memcpy(message.data() + sizeof(float), &borders[s + 1], sizeof(float));
+                if (!coordinators[s].first.send(message))
+                {
+                    std::cout << "Lost slab " << s << "!\n";
+                    failed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Hang up on the workers after a failure, so those still waiting for the coordinator give up
+    if (failed)
+    {
+        for (auto& c : coordinators)
+        {
+            c.first.close();
+        }
+    }
+
+    int code = failed ? 1 : 0;
+    for (const auto pid : workers)
+    {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            code = 1;
+        }
+    }
+
+    if (ticks != 0 && !failed)
+    {
+        std::cout << "Mean tick " << totalSeconds * 1000.0 / ticks << " ms, balance "
+                  << (totalSeconds > 0.0 ? idealSeconds / totalSeconds : 1.0) << '\n';
+    }
+    return code;
+}
@@ -0,0 +1,13 @@
+#ifndef SLABS_H
+#define SLABS_H
+
+// Simulate one flock of boids split into processes vertical slabs of the world, headless, for
+// ticks ticks. Each process owns the boids inside its slab, receives copies (ghosts) of the
+// boids within the neighbour distance of its borders from the adjacent slabs every tick, and
+// hands boids that cross a border to the adjacent slab. Every rebalanceInterval ticks (never if
+// 0) the borders are moved so each slab costs about the same to simulate, going by the tick
+// times measured since the last move. Fails if the slabs between two others would start out
+// narrower than the neighbour distance. Returns the process exit code.
+int runSlabs(const unsigned processes, const unsigned boids, const unsigned ticks, const unsigned rebalanceInterval);
+
+#endif // SLABS_H
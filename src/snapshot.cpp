@@ -0,0 +1,204 @@
+#include "snapshot.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+
+#include "mapped_file.h"
+
+namespace
+{
+std::uint64_t alignUp(const std::uint64_t offset)
+{
+    return (offset + snapshotAlignment - 1) / snapshotAlignment * snapshotAlignment;
+}
+
+// Write zeroes until the stream is at offset
+void padTo(std::ofstream& out, const std::uint64_t offset)
+{
+    static const char zeroes[snapshotAlignment] = {};
+    const auto position = static_cast<std::uint64_t>(out.tellp());
+    out.write(zeroes, static_cast<std::streamsize>(offset - position));
+}
+
+// Write count elements of array at offset
+template <typename T>
+void writeArray(std::ofstream& out, const std::uint64_t offset, const BoidArray<T>& array, const unsigned count)
+{
+    padTo(out, offset);
+    out.write(reinterpret_cast<const char*>(array.data()), static_cast<std::streamsize>(sizeof(T) * count));
+}
+
+// True if count Ts at offset lie within a file of fileSize bytes. Offsets and counts come from
+// the file, so this is written not to overflow on any of them.
+template <typename T>
+bool fits(const std::uint64_t offset, const std::uint64_t count, const std::uint64_t fileSize)
+{
+    return offset <= fileSize && count <= (fileSize - offset) / sizeof(T);
+}
+
+// Copy one stored tuple of accumulators into element. A std::tuple is not trivially copyable
+// even when everything in it is, so each accumulator is copied from its place in the tuple.
+template <typename... Accumulators>
+void readElement(std::tuple<Accumulators...>& element, const unsigned char* data)
+{
+    const auto* base = reinterpret_cast<const unsigned char*>(&element);
+    std::apply(
+        [&](auto&... accumulator) {
+            (std::memcpy(&accumulator, data + (reinterpret_cast<const unsigned char*>(&accumulator) - base),
+                         sizeof(accumulator)),
+             ...);
+        },
+        element);
+}
+
+// Replace array with the count Ts stored at offset
+template <typename T>
+void readArray(BoidArray<T>& array, const MappedFile& file, const std::uint64_t offset, const unsigned count)
+{
+    array.resize(count);
+    if constexpr (std::is_trivially_copyable_v<T>)
+    {
+        std::memcpy(array.data(), file.data() + offset, sizeof(T) * count);
+    }
+    else
+    {
+        for (unsigned i = 0; i != count; ++i)
+        {
+            readElement(array[i], file.data() + offset + sizeof(T) * i);
+        }
+    }
+}
+} // namespace
+
+bool Flock::saveSnapshot(const std::string& path) const
+{
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.version = snapshotVersion;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.count = m_count;
+    header.tick = m_tick;
+    header.params = m_params;
+    header.rngSeed = m_generator.seed();
+    header.rngDraws = m_generator.draws();
+    header.refreshAll = m_refreshAll;
+    header.fixedPoint = m_fixedPoint;
+    header.positionsOffset = alignUp(sizeof(SnapshotHeader));
+    header.velocitiesOffset = alignUp(header.positionsOffset + sizeof(glm::vec2) * m_count);
+    header.wideCacheOffset = alignUp(header.velocitiesOffset + sizeof(glm::vec2) * m_count);
+    header.fileSize = header.wideCacheOffset + sizeof(WideRules::Accumulators) * m_count;
+    if (m_fixedPoint)
+    {
+        header.fixedPositionsOffset = alignUp(header.fileSize);
+        header.fixedVelocitiesOffset = alignUp(header.fixedPositionsOffset + sizeof(FixedVec) * m_count);
+        header.fixedWideCacheOffset = alignUp(header.fixedVelocitiesOffset + sizeof(FixedVec) * m_count);
+        header.fileSize = header.fixedWideCacheOffset + sizeof(FixedWideAccumulator) * m_count;
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        std::cout << "Failed to open snapshot " << path << " for writing!\n";
+        return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeArray(out, header.positionsOffset, m_positions, m_count);
+    writeArray(out, header.velocitiesOffset, m_velocities, m_count);
+    writeArray(out, header.wideCacheOffset, m_wideCache, m_count);
+    if (m_fixedPoint)
+    {
+        writeArray(out, header.fixedPositionsOffset, m_fixedPositions, m_count);
+        writeArray(out, header.fixedVelocitiesOffset, m_fixedVelocities, m_count);
+        writeArray(out, header.fixedWideCacheOffset, m_fixedWideCache, m_count);
+    }
+
+    if (!out)
+    {
+        std::cout << "Failed to write snapshot " << path << "!\n";
+        return false;
+    }
+    return true;
+}
+
+bool Flock::loadSnapshot(const std::string& path)
+{
+    const MappedFile file(path);
+    if (!file)
+    {
+        std::cout << "Failed to map snapshot " << path << "!\n";
+        return false;
+    }
+
+    // Validate the header before trusting any offsets in it
+    SnapshotHeader header;
+    if (file.size() < sizeof(header))
+    {
+        std::cout << "Snapshot " << path << " is truncated!\n";
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, snapshotMagic, sizeof(header.magic)) != 0)
+    {
+        std::cout << path << " is not a snapshot!\n";
+        return false;
+    }
+    if (header.version != snapshotVersion || header.headerSize != sizeof(SnapshotHeader))
+    {
+        std::cout << "Snapshot " << path << " has unsupported version " << header.version << "!\n";
+        return false;
+    }
+    const auto size = header.fileSize;
+    const auto count = header.count;
+    if (size > file.size() || count > std::numeric_limits<unsigned>::max() ||
+        !fits<glm::vec2>(header.positionsOffset, count, size) ||
+        !fits<glm::vec2>(header.velocitiesOffset, count, size) ||
+        !fits<WideRules::Accumulators>(header.wideCacheOffset, count, size) ||
+        (header.fixedPoint != 0 && (!fits<FixedVec>(header.fixedPositionsOffset, count, size) ||
+                                    !fits<FixedVec>(header.fixedVelocitiesOffset, count, size) ||
+                                    !fits<FixedWideAccumulator>(header.fixedWideCacheOffset, count, size))))
+    {
+        std::cout << "Snapshot " << path << " is truncated!\n";
+        return false;
+    }
+
+    m_generator.restore(static_cast<std::uint32_t>(header.rngSeed), header.rngDraws);
+
+    // The arrays are stored exactly as they live in memory, so loading is a straight copy
+    const auto boids = static_cast<unsigned>(count);
+    reserve(boids);
+    readArray(m_positions, file, header.positionsOffset, boids);
+    readArray(m_velocities, file, header.velocitiesOffset, boids);
+    readArray(m_wideCache, file, header.wideCacheOffset, boids);
+    m_rotations.resize(boids);
+    m_steering.resize(boids);
+    m_nearestWide.assign(boids, std::numeric_limits<float>::infinity());
+    for (unsigned i = 0; i != boids; ++i)
+    {
+        m_rotations[i] = orientation(m_velocities[i]);
+    }
+    m_count = boids;
+    m_tick = static_cast<unsigned>(header.tick);
+    m_gpuAhead = false;
+    m_gpuStale = m_onGpu;
+
+    // The run resumes in the mode it was saved in, from the exact state of that mode
+    m_fixedPoint = header.fixedPoint != 0;
+    if (m_fixedPoint)
+    {
+        readArray(m_fixedPositions, file, header.fixedPositionsOffset, boids);
+        readArray(m_fixedVelocities, file, header.fixedVelocitiesOffset, boids);
+        readArray(m_fixedWideCache, file, header.fixedWideCacheOffset, boids);
+        m_fixedSteering.resize(boids);
+    }
+
+    // setParams() takes every cached neighbourhood to be stale, but these were gathered with
+    // the stored parameters
+    setParams(header.params);
+    m_refreshAll = header.refreshAll != 0;
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+
+#include "flock.h"
+
+// Binary snapshot of a Flock. The file is laid out so that it can be memory mapped and the
+// arrays copied out directly, without any parsing:
+//
+//   SnapshotHeader
+//   Positions         (count glm::vec2, snapshotAlignment aligned)
+//   Velocities        (count glm::vec2, snapshotAlignment aligned)
+//   Wide rule cache   (count WideRules::Accumulators, snapshotAlignment aligned)
+//   Fixed positions   (count FixedVec, only in fixed point mode, snapshotAlignment aligned)
+//   Fixed velocities  (count FixedVec, only in fixed point mode, snapshotAlignment aligned)
+//   Fixed wide cache  (count FixedWideAccumulator, only in fixed point mode, snapshotAlignment aligned)
+//
+// All offsets are from the start of the file. Values are stored in native byte order.
+// Rotations are derived from the above and rebuilt on load. With the cached wide rules stored
+// too, a loaded flock continues bit for bit where the saved one was. Metrics are not stored,
+// they pick up again as the boids refresh their wide rules.
+
+constexpr char snapshotMagic[8] = {'B', 'O', 'I', 'D', 'S', 'N', 'A', 'P'};
+
+// Bump whenever the layout of SnapshotHeader or the file changes
+constexpr std::uint32_t snapshotVersion = 3;
+
+// Alignment of every array in the file
+constexpr std::uint64_t snapshotAlignment = 64;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerSize;
+
+    // Number of boids and ticks simulated when the snapshot was taken
+    std::uint64_t count;
+    std::uint64_t tick;
+
+    // Flock parameters
+    FlockParams params;
+
+    // Random generator state, as its seed and the number of values drawn (see CountingGenerator)
+    std::uint64_t rngSeed, rngDraws;
+
+    // Non-zero if every boid was due to refresh its wide rules on the next tick, and if the
+    // flock simulated in fixed point, which stores the fixed point arrays
+    std::uint32_t refreshAll;
+    std::uint32_t fixedPoint;
+
+    // Offsets of the arrays that follow the header, the fixed point ones are 0 unless fixedPoint
+    std::uint64_t positionsOffset;
+    std::uint64_t velocitiesOffset;
+    std::uint64_t wideCacheOffset;
+    std::uint64_t fixedPositionsOffset;
+    std::uint64_t fixedVelocitiesOffset;
+    std::uint64_t fixedWideCacheOffset;
+
+    // Total size of the file, used to detect truncated snapshots
+    std::uint64_t fileSize;
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,129 @@
+#include "timing.h"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+#include "gl_core4_5.hpp"
+
+double TimingStats::mean() const
+{
+    if (m_samples.empty())
+    {
+        return 0.0;
+    }
+    return std::accumulate(m_samples.begin(), m_samples.end(), 0.0) / m_samples.size();
+}
+
+double TimingStats::percentile(const double q) const
+{
+    if (m_samples.empty())
+    {
+        return 0.0;
+    }
+    auto sorted = m_samples;
+    const auto k = std::min(sorted.size() - 1, static_cast<std::size_t>(q * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+}
+
+void TimingStats::print(const std::string& name) const
+{
+    std::cout << name << ": mean " << mean() << " ms, median " << percentile(0.5) << " ms, p99 "
+              << percentile(0.99) << " ms, max " << percentile(1.0) << " ms over " << count() << " samples\n";
+}
+
+PassTimer::~PassTimer()
+{
+    for (const auto& queries : m_pending)
+    {
+        m_free.insert(m_free.end(), queries.begin(), queries.end());
+    }
+    m_free.insert(m_free.end(), m_frameQueries.begin(), m_frameQueries.end());
+    if (!m_free.empty())
+    {
+        gl::DeleteQueries(static_cast<int>(m_free.size()), m_free.data());
+    }
+}
+
+void PassTimer::begin()
+{
+    unsigned query = 0;
+    if (m_free.empty())
+    {
+        gl::GenQueries(1, &query);
+    }
+    else
+    {
+        query = m_free.back();
+        m_free.pop_back();
+    }
+    m_frameQueries.push_back(query);
+    gl::BeginQuery(gl::TIME_ELAPSED, query);
+    m_start = std::chrono::steady_clock::now();
+}
+
+void PassTimer::end()
+{
+    gl::EndQuery(gl::TIME_ELAPSED);
+    m_frameCpu += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+void PassTimer::endFrame()
+{
+    if (!m_frameQueries.empty())
+    {
+        m_cpu.add(m_frameCpu);
+        m_pending.push_back(std::move(m_frameQueries));
+        m_frameQueries.clear();
+        m_frameCpu = 0.0;
+    }
+    collect(false);
+}
+
+void PassTimer::collect(const bool wait)
+{
+    while (!m_pending.empty())
+    {
+        // Queries finish in the order they were issued, so the last one stands for the frame
+        auto& queries = m_pending.front();
+        if (!wait)
+        {
+            int available = 0;
+            gl::GetQueryObjectiv(queries.back(), gl::QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                return;
+            }
+        }
+
+        GLuint64 total = 0;
+        for (const auto query : queries)
+        {
+            GLuint64 nanoseconds = 0;
+            gl::GetQueryObjectui64v(query, gl::QUERY_RESULT, &nanoseconds);
+            total += nanoseconds;
+        }
+        m_gpu.add(total / 1e6);
+        m_free.insert(m_free.end(), queries.begin(), queries.end());
+        m_pending.pop_front();
+    }
+}
+
+void PassTimer::finish()
+{
+    collect(true);
+}
+
+void PassTimer::reset()
+{
+    collect(true);
+    m_cpu = {};
+    m_gpu = {};
+}
+
+void PassTimer::print() const
+{
+    m_cpu.print(m_name + " CPU");
+    m_gpu.print(m_name + " GPU");
+}
@@ -0,0 +1,114 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Samples of a repeatedly measured duration, in milliseconds, and their summary
+class TimingStats
+{
+private:
+    std::vector<double> m_samples;
+
+public:
+    void add(const double ms) { m_samples.push_back(ms); }
+
+    std::size_t count() const { return m_samples.size(); }
+
+    double mean() const;
+
+    // Sample below which a fraction q (0 to 1) of all samples lie
+    double percentile(const double q) const;
+
+    // Print "name: mean, median, 99th percentile and largest sample" on one line
+    void print(const std::string& name) const;
+};
+
+// Times one phase of every frame (e.g. drawing) on the CPU, and on the GPU with TIME_ELAPSED
+// queries. A phase may be entered several times in a frame (e.g. uploads in chunks); all of its
+// segments add up to one sample per frame. Query results are only collected once the GPU has
+// them available, usually two or three frames later, so timing never stalls the pipeline.
+// Phases must not overlap, since only one TIME_ELAPSED query can be active at a time.
+class PassTimer
+{
+private:
+    std::string m_name;
+    TimingStats m_cpu, m_gpu;
+
+    // The current frame: start of the open segment, CPU time of the finished ones and the
+    // queries of all of them
+    std::chrono::steady_clock::time_point m_start;
+    double m_frameCpu = 0.0;
+    std::vector<unsigned> m_frameQueries;
+
+    // Queries of finished frames whose results have not been collected yet, oldest first
+    std::deque<std::vector<unsigned>> m_pending;
+
+    // Query objects ready for reuse
+    std::vector<unsigned> m_free;
+
+    // Add the GPU times of pending frames to the statistics, stopping at the first frame that is
+    // not available yet unless wait is set
+    void collect(const bool wait);
+
+public:
+    explicit PassTimer(std::string name) : m_name(std::move(name)) {}
+
+    PassTimer(const PassTimer&) = delete;
+    PassTimer& operator=(const PassTimer&) = delete;
+
+    // Needs the GL context that issued the queries to still be current
+    ~PassTimer();
+
+    // Start and end a segment of the phase
+    void begin();
+    void end();
+
+    // Close the current frame, if the phase ran in it, and collect whatever results are ready
+    void endFrame();
+
+    // Wait for every outstanding result
+    void finish();
+
+    // Forget all samples so far, e.g. those of warm-up frames
+    void reset();
+
+    const TimingStats& cpu() const { return m_cpu; }
+    const TimingStats& gpu() const { return m_gpu; }
+
+    // Print the CPU and GPU statistics, one line each
+    void print() const;
+};
+
+// Times the enclosing scope as a segment of timer's phase, does nothing if timer is null
+class TimedScope
+{
+private:
+    PassTimer* m_timer;
+
+public:
+    explicit TimedScope(PassTimer* timer) : m_timer(timer)
+    {
+        if (m_timer)
+        {
+            m_timer->begin();
+        }
+    }
+
+    TimedScope(const TimedScope&) = delete;
+    TimedScope& operator=(const TimedScope&) = delete;
+
+    ~TimedScope()
+    {
+        if (m_timer)
+        {
+            m_timer->end();
+        }
+    }
+};
+
+#endif // TIMING_H
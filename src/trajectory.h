@@ -0,0 +1,48 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <cstdint>
+
+// Trajectory files record the positions and velocities of a flock over many ticks:
+//
+//   TrajectoryHeader
+//   Chunk*      ChunkHeader followed by payloadSize bytes
+//
+// A raw chunk holds one tick, count glm::vec2 positions followed by count glm::vec2
+// velocities. A compressed chunk holds one tick encoded as described in codec.h, and may
+// depend on the compressed chunk before it. Ticks dropped by the recorder simply have no
+// chunk. Values are stored in native byte order.
+
+constexpr char trajectoryMagic[8] = {'B', 'O', 'I', 'D', 'T', 'R', 'A', 'J'};
+
+// Bump whenever the layout of the headers or any chunk type changes
+constexpr std::uint32_t trajectoryVersion = 1;
+
+struct TrajectoryHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerSize;
+};
+
+enum class ChunkType : std::uint32_t
+{
+    Raw = 0,
+    Compressed = 1,
+};
+
+struct ChunkHeader
+{
+    ChunkType type;
+
+    // Number of boids in the tick
+    std::uint32_t count;
+
+    // Tick the chunk was recorded at
+    std::uint64_t tick;
+
+    // Bytes following this header
+    std::uint64_t payloadSize;
+};
+
+#endif // TRAJECTORY_H
@@ -0,0 +1,248 @@
+// Spawning and despawning boids in any order keeps every per boid array in step with count()
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "flock.h"
+
+namespace
+{
+int failures = 0;
+
+void check(const bool ok, const char* what)
+{
+    if (!ok)
+    {
+        std::cout << "Failed: " << what << "!\n";
+        ++failures;
+    }
+}
+
+// Parameters under which boids never move, so metrics only depend on where they were placed
+FlockParams staticParams()
+{
+    FlockParams params;
+    params.cohesionWeight = 0.f;
+    params.alignmentWeight = 0.f;
+    params.separationWeight = 0.f;
+    params.targetWeight = 0.f;
+    params.wideRuleStride = 1000;
+    params.seed = 1;
+    return params;
+}
+
+// Random spawns and despawns mirrored on plain vectors, which must match the flock's arrays
+void interleavings(const unsigned threads, const bool fixedPoint)
+{
+    Flock flock(0, 4, staticParams());
+    flock.setThreads(threads);
+    flock.setFixedPoint(fixedPoint);
+    flock.setMetrics(MetricAll);
+
+    std::mt19937 rng(7);
+    // Whole coordinates survive the round trip through fixed point exactly
+    std::uniform_int_distribution<int> coordinate(0, 800);
+    std::vector<glm::vec2> positions;
+    for (unsigned step = 0; step != 2000; ++step)
+    {
+        if (rng() % 3 != 0 || positions.empty())
+        {
+            const glm::vec2 p(static_cast<float>(coordinate(rng)), static_cast<float>(coordinate(rng)));
+            check(flock.spawn(p, glm::vec2(0.f)) == positions.size(), "spawn returns the new index");
+            positions.push_back(p);
+        }
+        else
+        {
+            const auto index = static_cast<unsigned>(rng() % positions.size());
+            flock.despawn(index);
+            positions[index] = positions.back();
+            positions.pop_back();
+        }
+        if (step % 50 == 0)
+        {
+            flock.update(1.f / 120.f);
+        }
+
+        check(flock.count() == positions.size(), "count follows spawns and despawns");
+        check(flock.positions().size() == positions.size(), "positions follow count");
+        check(flock.velocities().size() == positions.size(), "velocities follow count");
+    }
+
+    flock.update(1.f / 120.f);
+    check(flock.count() <= flock.capacity(), "capacity covers count");
+    for (std::size_t i = 0; i != positions.size(); ++i)
+    {
+        check(flock.positions()[i] == positions[i], "despawn moves the last boid into place");
+    }
+    check(std::isfinite(flock.metrics().meanNearestNeighbour), "nearest neighbour stays finite");
+}
+
+// The nearest neighbour found by the last wide refresh of a boid must move with the boid
+void nearestFollowsBoids()
+{
+    Flock flock(0, 4, staticParams());
+    flock.setMetrics(MetricNearestNeighbour);
+
+    // Two pairs, 50 and 30 apart, every boid refreshes its wide neighbourhood on the first tick
+    // only, and nothing moves
+    flock.spawn({0.f, 0.f}, glm::vec2(0.f));
+    flock.spawn({50.f, 0.f}, glm::vec2(0.f));
+    flock.spawn({400.f, 400.f}, glm::vec2(0.f));
+    flock.spawn({430.f, 400.f}, glm::vec2(0.f));
+    for (unsigned t = 0; t != 5; ++t)
+    {
+        flock.update(1.f / 120.f);
+    }
+    check(std::abs(flock.metrics().meanNearestNeighbour - 40.f) < 1e-3f, "nearest neighbour of two pairs");
+
+    // A lone boid moves into the slot of the first one, and brings no neighbour with it
+    flock.spawn({800.f, 0.f}, glm::vec2(0.f));
+    flock.despawn(0);
+    flock.update(1.f / 120.f);
+    check(std::abs(flock.metrics().meanNearestNeighbour - 110.f / 3.f) < 1e-3f,
+          "nearest neighbour after swap-remove");
+}
+
+// Collisions are found even when boids only avoid each other at a shorter distance
+void collisionsBelowAvoidance()
+{
+    auto params = staticParams();
+    params.avoidanceDistance = 0.5f;
+    Flock flock(0, 4, params);
+    flock.setMetrics(MetricCollisions);
+    flock.spawn({100.f, 100.f}, glm::vec2(0.f));
+    flock.spawn({101.5f, 100.f}, glm::vec2(0.f));
+    flock.spawn({300.f, 300.f}, glm::vec2(0.f));
+    flock.spawn({300.f, 301.9f}, glm::vec2(0.f));
+    flock.spawn({500.f, 500.f}, glm::vec2(0.f));
+    flock.update(1.f / 120.f);
+    check(flock.metrics().collisions == 2, "collisions beyond the avoidance distance");
+}
+
+// Once boids and ghosts have been placed, not even the first tick grows the arena or spills onto
+// the heap
+void steadyArena(const bool fixedPoint)
+{
+    Flock flock(3000, 0, staticParams());
+    flock.setThreads(2);
+    flock.setFixedPoint(fixedPoint);
+    std::vector<glm::vec2> ghosts, ghostVelocities(500, glm::vec2(0.f));
+    for (unsigned g = 0; g != 500; ++g)
+    {
+        ghosts.emplace_back(static_cast<float>(g % 25) * 30.f, static_cast<float>(g / 25) * 30.f);
+    }
+    flock.setGhosts(ghosts.data(), ghostVelocities.data(), 500);
+    const auto before = flock.footprint();
+    for (unsigned t = 0; t != 5; ++t)
+    {
+        flock.setGhosts(ghosts.data(), ghostVelocities.data(), 500 - 100 * (t % 2));
+        flock.update(1.f / 120.f);
+    }
+    const auto after = flock.footprint();
+    check(before.heap == 0 && after.heap == 0, "boids and ghosts fit in the arena");
+    check(after.used == before.used, "ticks do not grow the arena");
+}
+
+// Turning metrics on in the middle of a run leaves the boids where they would have been
+void metricsOnlyObserve()
+{
+    FlockParams params;
+    params.seed = 2;
+    Flock plain(2000, 0, params), observed(2000, 0, params);
+    for (unsigned t = 0; t != 30; ++t)
+    {
+        if (t == 7)
+        {
+            observed.setMetrics(MetricAll);
+        }
+        plain.update(1.f / 120.f);
+        observed.update(1.f / 120.f);
+    }
+    bool same = true;
+    for (unsigned i = 0; i != plain.count(); ++i)
+    {
+        same = same && plain.positions()[i] == observed.positions()[i] &&
+               plain.velocities()[i] == observed.velocities()[i];
+    }
+    check(same, "metrics do not change the trajectory");
+    check(observed.metrics().meanNearestNeighbour > 0.f, "nearest neighbour fills in");
+}
+
+// Spawn count boids spread thin enough for each to have a dozen or so neighbours, moving freely
+void spreadOut(Flock& flock, const unsigned count, const unsigned threads, const bool fixedPoint)
+{
+    flock.setTarget({4000.f, 4000.f});
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> position(0.f, 8000.f), velocity(-2.f, 2.f);
+    for (unsigned i = 0; i != count; ++i)
+    {
+        const float x = position(rng), y = position(rng), vx = velocity(rng), vy = velocity(rng);
+        flock.spawn({x, y}, {vx, vy});
+    }
+    flock.setThreads(threads);
+    flock.setFixedPoint(fixedPoint);
+    flock.setMetrics(MetricAll);
+}
+
+// Any number of workers moves the boids bit for bit like a single thread. With enough boids for
+// Grid::build() to split them into blocks of minBlockSize, each with a histogram of its own.
+void threadCountInvariance(const unsigned threads, const bool fixedPoint)
+{
+    FlockParams params;
+    params.seed = 3;
+    Flock single(0, 50000, params), several(0, 50000, params);
+    spreadOut(single, 50000, 1, fixedPoint);
+    spreadOut(several, 50000, threads, fixedPoint);
+    bool same = true, sameMetrics = true;
+    for (unsigned t = 0; t != 10; ++t)
+    {
+        single.update(1.f / 120.f);
+        several.update(1.f / 120.f);
+        const auto& a = single.metrics();
+        const auto& b = several.metrics();
+        sameMetrics = sameMetrics && a.orderParameter == b.orderParameter && a.clusterCount == b.clusterCount &&
+                      a.meanNearestNeighbour == b.meanNearestNeighbour && a.collisions == b.collisions;
+    }
+    for (unsigned i = 0; i != single.count(); ++i)
+    {
+        same = same && single.positions()[i] == several.positions()[i] &&
+               single.velocities()[i] == several.velocities()[i];
+    }
+    check(same, "any number of threads moves the boids like one");
+    check(sameMetrics, "any number of threads measures the flock like one");
+}
+
+// Out of range indices, and despawning from an empty flock, are ignored
+void outOfRange()
+{
+    Flock flock(0, 0, staticParams());
+    flock.despawn(0);
+    check(flock.count() == 0, "despawn on an empty flock");
+
+    flock.spawn({1.f, 2.f}, glm::vec2(0.f));
+    flock.despawn(1);
+    check(flock.count() == 1, "despawn past the end");
+    flock.despawn(0);
+    flock.despawn(0);
+    check(flock.count() == 0 && flock.positions().empty(), "despawn of the last boid");
+    flock.update(1.f / 120.f);
+}
+} // namespace
+
+int main()
+{
+    interleavings(1, false);
+    interleavings(3, false);
+    interleavings(1, true);
+    nearestFollowsBoids();
+    collisionsBelowAvoidance();
+    outOfRange();
+    metricsOnlyObserve();
+    threadCountInvariance(3, false);
+    threadCountInvariance(4, true);
+    steadyArena(false);
+    steadyArena(true);
+    return failures == 0 ? 0 : 1;
+}
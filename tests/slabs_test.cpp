@@ -0,0 +1,118 @@
+// Slab runs finish cleanly, and fail instead of hanging when a worker process dies
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "slabs.h"
+
+namespace
+{
+int failures = 0;
+
+void check(const bool ok, const char* what)
+{
+    if (!ok)
+    {
+        std::cout << "Failed: " << what << "!\n";
+        ++failures;
+    }
+}
+
+// Processes whose parent is this one, read from /proc
+std::vector<pid_t> children()
+{
+    std::vector<pid_t> pids;
+    DIR* proc = opendir("/proc");
+    if (!proc)
+    {
+        return pids;
+    }
+    while (const dirent* entry = readdir(proc))
+    {
+        const pid_t pid = std::atoi(entry->d_name);
+        if (pid <= 0)
+        {
+            continue;
+        }
+
+        // The command name in field 2 may contain spaces, the parent follows the state after it
+        std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+        std::string line;
+        std::getline(stat, line);
+        const auto close = line.rfind(')');
+        if (close == std::string::npos)
+        {
+            continue;
+        }
+        std::istringstream fields(line.substr(close + 1));
+        char state;
+        pid_t parent = 0;
+        fields >> state >> parent;
+        if (parent == getpid() && state != 'Z')
+        {
+            pids.push_back(pid);
+        }
+    }
+    closedir(proc);
+
+    // Workers are forked in slab order
+    std::sort(pids.begin(), pids.end());
+    return pids;
+}
+
+// Kill one of the slab workers once all of them run
+void killWorker(const unsigned processes, const unsigned victim)
+{
+    for (;;)
+    {
+        const auto pids = children();
+        if (pids.size() == processes)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            kill(pids[victim], SIGKILL);
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+// Take the workers down too when the test hangs, they would otherwise run on forever
+void timeout(int)
+{
+    kill(0, SIGKILL);
+}
+} // namespace
+
+int main()
+{
+    // A hang is a failure too, and ends the test along with every worker in its process group
+    setpgid(0, 0);
+    std::signal(SIGALRM, timeout);
+    alarm(120);
+
+    check(runSlabs(3, 2000, 30, 10) == 0, "three slabs with rebalancing");
+    check(runSlabs(1, 500, 10, 0) == 0, "a single slab");
+    check(runSlabs(10, 2000, 10, 5) == 0, "slabs as narrow as the neighbour distance");
+    check(runSlabs(11, 2000, 10, 5) != 0, "slabs narrower than the neighbour distance");
+
+    // Killing a worker in the middle and at either end must end the run with an error
+    for (const unsigned victim : {1u, 0u, 2u})
+    {
+        std::thread killer(killWorker, 3, victim);
+        check(runSlabs(3, 2000, 1000000, 50) != 0, "a killed worker fails the run");
+        killer.join();
+        check(children().empty(), "every worker is reaped");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// A flock loaded from a snapshot continues bit for bit like the one that saved it
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "flock.h"
+#include "snapshot.h"
+
+namespace
+{
+int failures = 0;
+
+void check(const bool ok, const char* what)
+{
+    if (!ok)
+    {
+        std::cout << "Failed: " << what << "!\n";
+        ++failures;
+    }
+}
+
+const char* snapshotPath = "snapshot_test.snap";
+const glm::vec2 target(400.f, 400.f);
+
+bool sameBits(const BoidArray<glm::vec2>& a, const BoidArray<glm::vec2>& b)
+{
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), sizeof(glm::vec2) * a.size()) == 0;
+}
+
+// Save after ticks ticks, load into a fresh flock of a different size and compare both after
+// more ticks. ticks is not a multiple of the wide rule stride, so the staggered cache matters.
+void roundTrip(const bool fixedPoint, const unsigned ticks, const unsigned more)
+{
+    FlockParams params;
+    params.seed = 3;
+    Flock flock(2000, 0, params);
+    flock.setTarget(target);
+    flock.setFixedPoint(fixedPoint);
+    for (unsigned t = 0; t != ticks; ++t)
+    {
+        flock.update(1.f / 120.f);
+    }
+    check(flock.saveSnapshot(snapshotPath), "save");
+
+    FlockParams other;
+    other.seed = 4;
+    other.neighbourDistance = 40.f;
+    Flock loaded(10, 0, other);
+    loaded.setTarget(target);
+    loaded.setFixedPoint(fixedPoint);
+    check(loaded.loadSnapshot(snapshotPath), "load");
+    check(loaded.tick() == flock.tick() && loaded.count() == flock.count(), "tick and count");
+
+    for (unsigned t = 0; t != more; ++t)
+    {
+        flock.update(1.f / 120.f);
+        loaded.update(1.f / 120.f);
+    }
+    check(sameBits(flock.positions(), loaded.positions()), "positions continue bit for bit");
+    check(sameBits(flock.velocities(), loaded.velocities()), "velocities continue bit for bit");
+    std::remove(snapshotPath);
+}
+
+// A fixed point snapshot resumes in fixed point even in a float flock, and asking for fixed
+// point again afterwards, as --fixed does, keeps the loaded state
+void modeFollowsSnapshot()
+{
+    FlockParams params;
+    params.seed = 6;
+    Flock flock(2000, 0, params);
+    flock.setTarget(target);
+    flock.setFixedPoint(true);
+    for (unsigned t = 0; t != 7; ++t)
+    {
+        flock.update(1.f / 120.f);
+    }
+    check(flock.saveSnapshot(snapshotPath), "save fixed");
+
+    Flock loaded(10, 0, {});
+    loaded.setTarget(target);
+    check(loaded.loadSnapshot(snapshotPath), "load fixed");
+    check(loaded.fixedPoint(), "fixed point mode is restored");
+    loaded.setFixedPoint(true);
+    for (unsigned t = 0; t != 50; ++t)
+    {
+        flock.update(1.f / 120.f);
+        loaded.update(1.f / 120.f);
+    }
+    check(sameBits(flock.positions(), loaded.positions()), "fixed point continues bit for bit");
+    std::remove(snapshotPath);
+}
+
+// The random generator continues where it was, 100 boids drew four values each
+void generator()
+{
+    FlockParams params;
+    params.seed = 5;
+    Flock flock(100, 0, params);
+    check(flock.saveSnapshot(snapshotPath), "save generator");
+    Flock loaded(1, 0, {});
+    check(loaded.loadSnapshot(snapshotPath), "load generator");
+    check(loaded.saveSnapshot(snapshotPath), "save loaded generator");
+    std::ifstream in(snapshotPath, std::ios::binary);
+    SnapshotHeader header{};
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    check(header.rngSeed == 5 && header.rngDraws == 400, "generator state");
+    std::remove(snapshotPath);
+}
+
+// Offsets that would wrap around when added to the array sizes are rejected
+void overflowingOffsets()
+{
+    Flock flock(10, 0, {});
+    check(flock.saveSnapshot(snapshotPath), "save for corruption");
+
+    SnapshotHeader header{};
+    {
+        std::ifstream in(snapshotPath, std::ios::binary);
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    }
+    header.positionsOffset = std::numeric_limits<std::uint64_t>::max() - 7;
+    {
+        std::fstream out(snapshotPath, std::ios::binary | std::ios::in | std::ios::out);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    Flock loaded(1, 0, {});
+    check(!loaded.loadSnapshot(snapshotPath), "overflowing offset is rejected");
+    check(loaded.count() == 1, "rejected snapshot leaves the flock alone");
+    std::remove(snapshotPath);
+}
+} // namespace
+
+int main()
+{
+    roundTrip(false, 7, 50);
+    roundTrip(true, 7, 50);
+    roundTrip(false, 0, 10);
+    modeFollowsSnapshot();
+    generator();
+    overflowingOffsets();
+    return failures == 0 ? 0 : 1;
+}